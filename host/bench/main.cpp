@@ -0,0 +1,257 @@
+// Runs a corpus of AVI and JPEG files through the MediaPlayer render path
+// as fast as it can and checks what ends up on the panel:
+//
+//   .pio/build/native-bench/program <corpus> [--update]
+//
+// For each file it prints frames/s and the time per pixel spent decoding
+// and sending frames to the panel. The panel is checksummed after every
+// frame and the running CRC of the whole file is compared with the one in
+// <corpus>/golden.txt. --update writes the CRCs of this run as the new
+// golden ones, make_corpus.sh builds a corpus to start from.
+
+#include "Battery.h"
+#include "Display.h"
+#include "MediaPlayer.h"
+#include "Metrics.h"
+#include "Prefs.h"
+#include "VideoPlayer/AVIParser.h"
+#include <Arduino.h>
+#include <TFT_eSPI.h>
+#include <dirent.h>
+#include <esp_rom_crc.h>
+#include <unistd.h>
+#include <map>
+#include <vector>
+
+// the frame being shown and the one being read
+const int BENCH_FRAME_SLOTS = 3;
+
+typedef struct
+{
+  int frames;
+  uint32_t crc;
+  int64_t decodeUs;
+  int64_t flushUs;
+  uint64_t decodedPixels;
+  uint64_t pushedPixels;
+} BenchResult;
+
+// Renders the frames it's given on the calling task, just as the render
+// worker would, and waits for each one to reach the panel
+class BenchPlayer : public MediaPlayer
+{
+private:
+  FrameHandle mNextFrame;
+
+protected:
+  FrameHandle getFrame() override { return std::move(mNextFrame); }
+
+public:
+  BenchPlayer(Display &display, Prefs &prefs, Battery &battery)
+      : MediaPlayer(display, prefs, battery)
+  {
+    changeState(MediaPlayerState::PLAYING);
+  }
+
+  void showFrame(FrameHandle frame, BenchResult &result)
+  {
+    mNextFrame = std::move(frame);
+    uint32_t decodedBefore = Metrics::getCount(Counter::FRAMES_DECODED);
+    int64_t start = esp_timer_get_time();
+    renderFrame();
+    int64_t decoded = esp_timer_get_time();
+    mDisplay.waitForFlush();
+    result.decodeUs += decoded - start;
+    result.flushUs += esp_timer_get_time() - decoded;
+    // repeats and cached frames aren't decoded, so they'd flatter ns/px
+    if (Metrics::getCount(Counter::FRAMES_DECODED) != decodedBefore)
+    {
+      result.decodedPixels += mDrawWidth * mDrawHeight;
+    }
+    result.pushedPixels += mDisplay.getFlushStats().lastPixelsPushed;
+    result.frames++;
+  }
+
+  // Start the next file from a blank panel
+  void reset()
+  {
+    mCurrentFrame.reset();
+    mCurrentFingerprint = 0;
+    mDisplay.fillScreen(DisplayColors::BLACK);
+  }
+};
+
+static std::vector<uint16_t> panelPixels;
+
+static uint32_t panelCrc(uint32_t crc)
+{
+  TFT_eSPI *panel = TFT_eSPI::getPanel();
+  panelPixels.resize(panel->width() * panel->height());
+  panel->readRect(0, 0, panel->width(), panel->height(), panelPixels.data());
+  return esp_rom_crc32_le(crc, (const uint8_t *)panelPixels.data(),
+                          panelPixels.size() * 2);
+}
+
+static bool hasExtension(const std::string &name, const char *extension)
+{
+  size_t length = strlen(extension);
+  return name.length() > length &&
+         strcasecmp(name.c_str() + name.length() - length, extension) == 0;
+}
+
+static BenchResult runAvi(BenchPlayer &player, FramePool &pool,
+                          const std::string &path)
+{
+  BenchResult result = {};
+  AVIParser parser(path, AVIChunkType::VIDEO);
+  if (!parser.open())
+  {
+    return result;
+  }
+  while (true)
+  {
+    FrameHandle frame = pool.acquire(0, portMAX_DELAY);
+    Frame *slot = frame.get();
+    slot->length = parser.getNextChunk(&slot->data, slot->capacity);
+    if (slot->length == 0)
+    {
+      break;
+    }
+    player.showFrame(std::move(frame), result);
+    result.crc = panelCrc(result.crc);
+  }
+  return result;
+}
+
+static BenchResult runJpeg(BenchPlayer &player, FramePool &pool,
+                           const std::string &path)
+{
+  BenchResult result = {};
+  FILE *f = fopen(path.c_str(), "rb");
+  if (!f)
+  {
+    return result;
+  }
+  fseek(f, 0, SEEK_END);
+  size_t length = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  FrameHandle frame = pool.acquire(length, portMAX_DELAY);
+  if (frame)
+  {
+    frame.get()->length = fread(frame.data(), 1, length, f);
+    player.showFrame(std::move(frame), result);
+    result.crc = panelCrc(result.crc);
+  }
+  fclose(f);
+  return result;
+}
+
+static std::map<std::string, uint32_t> loadGolden(const std::string &path)
+{
+  std::map<std::string, uint32_t> golden;
+  FILE *f = fopen(path.c_str(), "r");
+  if (!f)
+  {
+    return golden;
+  }
+  char name[256];
+  uint32_t crc;
+  while (fscanf(f, "%255s %x", name, &crc) == 2)
+  {
+    golden[name] = crc;
+  }
+  fclose(f);
+  return golden;
+}
+
+static double nsPerPixel(int64_t us, uint64_t pixels)
+{
+  return pixels > 0 ? us * 1000.0 / pixels : 0;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 2)
+  {
+    Serial.printf("usage: %s <corpus> [--update]\n", argv[0]);
+    return 2;
+  }
+  std::string corpus = argv[1];
+  bool update = argc > 2 && strcmp(argv[2], "--update") == 0;
+  std::string goldenPath = corpus + "/golden.txt";
+
+  std::vector<std::string> files;
+  DIR *dir = opendir(corpus.c_str());
+  if (!dir)
+  {
+    Serial.printf("Can't open %s\n", corpus.c_str());
+    return 2;
+  }
+  struct dirent *ent;
+  while ((ent = readdir(dir)) != NULL)
+  {
+    std::string name = ent->d_name;
+    if (hasExtension(name, ".avi") || hasExtension(name, ".jpg") ||
+        hasExtension(name, ".jpeg"))
+    {
+      files.push_back(name);
+    }
+  }
+  closedir(dir);
+  std::sort(files.begin(), files.end());
+
+  Prefs prefs;
+  prefs.begin();
+  Display display(&prefs);
+  Battery battery(0, 3.3, 200000.0, 100000.0);
+  battery.begin();
+  BenchPlayer player(display, prefs, battery);
+  FramePool pool(BENCH_FRAME_SLOTS);
+
+  std::map<std::string, uint32_t> golden = loadGolden(goldenPath);
+  std::map<std::string, uint32_t> results;
+  int failures = 0;
+  Serial.printf("%-24s %6s %8s %12s %12s  %s\n", "file", "frames", "fps",
+                "decode ns/px", "flush ns/px", "crc");
+  for (const auto &name : files)
+  {
+    player.reset();
+    std::string path = corpus + "/" + name;
+    BenchResult result = hasExtension(name, ".avi")
+                             ? runAvi(player, pool, path)
+                             : runJpeg(player, pool, path);
+    int64_t totalUs = result.decodeUs + result.flushUs;
+    const char *verdict = "new";
+    if (golden.count(name))
+    {
+      verdict = golden[name] == result.crc ? "ok" : "FAIL";
+    }
+    if (strcmp(verdict, "FAIL") == 0)
+    {
+      failures++;
+    }
+    Serial.printf("%-24s %6d %8.1f %12.2f %12.2f  %08x %s\n", name.c_str(),
+                  result.frames,
+                  totalUs > 0 ? result.frames * 1000000.0 / totalUs : 0,
+                  nsPerPixel(result.decodeUs, result.decodedPixels),
+                  nsPerPixel(result.flushUs, result.pushedPixels), result.crc,
+                  verdict);
+    results[name] = result.crc;
+  }
+
+  if (update)
+  {
+    FILE *f = fopen(goldenPath.c_str(), "w");
+    for (const auto &entry : results)
+    {
+      fprintf(f, "%s %08x\n", entry.first.c_str(), entry.second);
+    }
+    fclose(f);
+    Serial.printf("Wrote %d CRCs to %s\n", (int)results.size(),
+                  goldenPath.c_str());
+    failures = 0;
+  }
+  // the display tasks never return, leave without tearing down what they use
+  fflush(stdout);
+  _exit(failures > 0 ? 1 : 0);
+}
@@ -0,0 +1,50 @@
+#!/bin/sh
+# Build a benchmark corpus from ffmpeg's test sources, then record its golden
+# CRCs with a build known to be good:
+#
+#   host/bench/make_corpus.sh corpus
+#   .pio/build/native-bench/program corpus --update
+#
+# The CRCs depend on the exact bytes ffmpeg writes, so they're kept with the
+# corpus rather than in the repo.
+set -e
+
+out=${1:-corpus}
+mkdir -p "$out"
+
+clip() {
+  name=$1
+  shift
+  ffmpeg -v error -y "$@" -t 3 "$out/$name"
+}
+
+moving="-f lavfi -i testsrc2=size=288x240:rate=25"
+
+# quantizer range, same filter chain as the README otherwise
+clip q02.avi $moving -an -c:v mjpeg -q:v 2
+clip q10.avi $moving -an -c:v mjpeg -q:v 10
+clip q31.avi $moving -an -c:v mjpeg -q:v 31
+
+# narrower than the panel (letterboxed), exactly as wide, and tiny
+clip w200.avi -f lavfi -i testsrc2=size=200x240:rate=25 -an -c:v mjpeg -q:v 10
+clip w280.avi -f lavfi -i testsrc2=size=280x240:rate=25 -an -c:v mjpeg -q:v 10
+clip w160h120.avi -f lavfi -i testsrc2=size=160x120:rate=25 -an -c:v mjpeg -q:v 10
+
+# no chroma subsampling
+clip yuv444.avi $moving -an -c:v mjpeg -q:v 10 -pix_fmt yuvj444p
+
+# a still picture, every frame is a repeat of the one on screen
+clip still.avi -f lavfi -i color=c=navy:size=288x240:rate=25 -an -c:v mjpeg -q:v 10
+
+# audio chunks interleaved with the video ones
+clip audio.avi $moving -f lavfi -i sine=frequency=440:sample_rate=22050 \
+  -c:v mjpeg -q:v 10 -c:a pcm_u8
+
+# stills for the slideshow path
+ffmpeg -v error -y $moving -frames:v 1 -q:v 5 "$out/still.jpg"
+ffmpeg -v error -y -f lavfi -i testsrc2=size=240x240 -frames:v 1 -q:v 5 \
+  -pix_fmt yuvj444p "$out/still444.jpg"
+# restart markers after every MCU row, if jpegtran is around
+if command -v jpegtran >/dev/null; then
+  jpegtran -restart 1 -outfile "$out/restart.jpg" "$out/still.jpg"
+fi
@@ -0,0 +1,84 @@
+#pragma once
+
+// The parts of the Arduino core the playback pipeline uses, for the native
+// build
+
+#include <math.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+using std::max;
+using std::min;
+
+#define IRAM_ATTR
+#define constrain(amt, low, high) \
+  ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define LOW 0x0
+#define HIGH 0x1
+
+// millis and micros run off HostClock
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(uint32_t us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+// reads full scale, so the battery always looks charged
+uint16_t analogRead(uint8_t pin);
+void ledcSetup(uint8_t channel, double freq, uint8_t resolution);
+void ledcAttachPin(uint8_t pin, uint8_t channel);
+void ledcWrite(uint8_t channel, uint32_t duty);
+
+void *ps_malloc(size_t size);
+void *ps_calloc(size_t n, size_t size);
+void *ps_realloc(void *ptr, size_t size);
+
+class String : public std::string
+{
+public:
+  String() {}
+  String(const char *s) : std::string(s ? s : "") {}
+  String(const std::string &s) : std::string(s) {}
+  explicit String(int value) : std::string(std::to_string(value)) {}
+  bool isEmpty() const { return empty(); }
+  int toInt() const { return atoi(c_str()); }
+  String substring(size_t from) const { return String(substr(from)); }
+  String substring(size_t from, size_t to) const
+  {
+    return String(substr(from, to - from));
+  }
+};
+
+// Writes to stdout
+class HardwareSerial
+{
+public:
+  void begin(unsigned long baud) {}
+  int printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+  size_t print(const char *s);
+  size_t print(const String &s) { return print(s.c_str()); }
+  size_t print(int value);
+  size_t println(const char *s = "");
+  size_t println(const String &s) { return println(s.c_str()); }
+  size_t println(int value);
+};
+
+extern HardwareSerial Serial;
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+
+// The clock behind millis, micros, esp_timer_get_time and every FreeRTOS
+// timeout in the native build. It follows the wall clock, optionally sped
+// up, and can be moved forward by hand.
+namespace HostClock
+{
+  int64_t nowUs();
+  // 1 is real time, 4 runs four times faster
+  void setSpeed(float speed);
+  float getSpeed();
+  // Jump forward, tasks already waiting still wake at their old deadline
+  void advance(int64_t us);
+  // How long to really wait for a span of clock time
+  std::chrono::microseconds toWallTime(int64_t us);
+}
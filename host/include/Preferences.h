@@ -0,0 +1,24 @@
+#pragma once
+
+// Preferences for the native build, kept in memory for the life of the
+// process
+
+#include <Arduino.h>
+#include <map>
+
+class Preferences
+{
+private:
+  std::map<std::string, int32_t> ints;
+  std::map<std::string, String> strings;
+
+public:
+  bool begin(const char *name, bool readOnly = false) { return true; }
+  void end() {}
+  bool clear();
+  bool isKey(const char *key);
+  int32_t getInt(const char *key, int32_t defaultValue = 0);
+  size_t putInt(const char *key, int32_t value);
+  String getString(const char *key, String defaultValue = String());
+  size_t putString(const char *key, String value);
+};
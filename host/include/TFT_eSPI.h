@@ -0,0 +1,95 @@
+#pragma once
+
+// TFT_eSPI for the native build. The panel is an RGB565 framebuffer in
+// memory, pixels are stored exactly as they were pushed and text is only
+// measured, not drawn.
+
+#include <Arduino.h>
+
+#define TFT_BLACK 0x0000
+#define TFT_WHITE 0xFFFF
+#define TFT_GREEN 0x07E0
+#define TFT_ORANGE 0xFDA0
+
+#ifndef TFT_WIDTH
+#define TFT_WIDTH 240
+#endif
+#ifndef TFT_HEIGHT
+#define TFT_HEIGHT 280
+#endif
+
+class TFT_eSPI
+{
+protected:
+  int16_t _width;
+  int16_t _height;
+  uint8_t textFont = 1;
+  uint8_t textSize = 1;
+  // the panel, allocated by init
+  uint16_t *panel = NULL;
+  // the address window pushPixels writes into
+  int32_t windowX = 0, windowY = 0, windowWidth = 0, windowHeight = 0;
+  int32_t windowPos = 0;
+
+  int16_t fontWidth();
+  void writeRect(uint16_t *dest, int16_t destWidth, int16_t destHeight,
+                 int32_t x, int32_t y, int32_t w, int32_t h,
+                 const uint16_t *pixels);
+
+public:
+  TFT_eSPI(int16_t w = TFT_WIDTH, int16_t h = TFT_HEIGHT);
+  virtual ~TFT_eSPI();
+  void init();
+  // The panel initialised last, for the native tools to check what was
+  // drawn on it
+  static TFT_eSPI *getPanel();
+  void setRotation(uint8_t rotation);
+  int16_t width() { return _width; }
+  int16_t height() { return _height; }
+
+  void fillScreen(uint32_t color);
+  void fillRect(int32_t x, int32_t y, int32_t w, int32_t h, uint32_t color);
+  void pushImage(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t *data);
+  // Copy pixels back out of the framebuffer
+  void readRect(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t *data);
+
+  void startWrite() {}
+  void endWrite() {}
+  void setAddrWindow(int32_t x, int32_t y, int32_t w, int32_t h);
+  void pushPixels(const void *data, uint32_t len);
+  // "DMA" transfers complete before they return
+  bool initDMA(bool ctrl_cs = false) { return true; }
+  void deInitDMA() {}
+  void pushPixelsDMA(uint16_t *data, uint32_t len) { pushPixels(data, len); }
+  bool dmaBusy() { return false; }
+  void dmaWait() {}
+
+  void setTextFont(uint8_t font) { textFont = font; }
+  void setTextSize(uint8_t size) { textSize = size > 0 ? size : 1; }
+  void setTextColor(uint16_t color, uint16_t background) {}
+  void setCursor(int16_t x, int16_t y) {}
+  size_t print(const char *text) { return strlen(text); }
+  size_t println(const char *text) { return strlen(text) + 1; }
+  int16_t textWidth(const char *text);
+  int16_t fontHeight();
+};
+
+class TFT_eSprite : public TFT_eSPI
+{
+private:
+  TFT_eSPI *tft;
+  uint16_t *pixels = NULL;
+
+public:
+  TFT_eSprite(TFT_eSPI *tft);
+  ~TFT_eSprite();
+  // Only 16 bit sprites are supported
+  void *createSprite(int16_t w, int16_t h, uint8_t frames = 1);
+  void deleteSprite();
+  bool created() { return pixels != NULL; }
+  void *getPointer() { return pixels; }
+
+  void fillSprite(uint32_t color);
+  void pushImage(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t *data);
+  void pushSprite(int32_t x, int32_t y);
+};
@@ -0,0 +1,15 @@
+#pragma once
+
+// Only the types SDCard.h declares its members with, the native SDCard
+// reads a directory on the host instead
+
+#include <stdint.h>
+
+typedef int gpio_num_t;
+typedef struct sdmmc_card_t sdmmc_card_t;
+typedef struct
+{
+  int slot;
+  int max_freq_khz;
+  uint32_t flags;
+} sdmmc_host_t;
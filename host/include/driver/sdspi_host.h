@@ -0,0 +1,5 @@
+#pragma once
+
+#include "sdmmc_types.h"
+
+#define SDSPI_HOST_DEFAULT() {1, 20000, 0}
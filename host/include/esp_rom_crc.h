@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdint.h>
+
+// same result as the ROM function, the zlib CRC-32
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len);
@@ -0,0 +1,129 @@
+#include <Arduino.h>
+#include <esp_rom_crc.h>
+#include "HostClock.h"
+#include <thread>
+
+HardwareSerial Serial;
+
+int HardwareSerial::printf(const char *format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  int written = vprintf(format, args);
+  va_end(args);
+  return written;
+}
+
+size_t HardwareSerial::print(const char *s)
+{
+  return fputs(s, stdout) < 0 ? 0 : strlen(s);
+}
+
+size_t HardwareSerial::print(int value)
+{
+  return ::printf("%d", value);
+}
+
+size_t HardwareSerial::println(const char *s)
+{
+  return ::printf("%s\n", s);
+}
+
+size_t HardwareSerial::println(int value)
+{
+  return ::printf("%d\n", value);
+}
+
+int64_t esp_timer_get_time()
+{
+  return HostClock::nowUs();
+}
+
+unsigned long millis()
+{
+  return HostClock::nowUs() / 1000;
+}
+
+unsigned long micros()
+{
+  return HostClock::nowUs();
+}
+
+void delay(unsigned long ms)
+{
+  std::this_thread::sleep_for(HostClock::toWallTime((int64_t)ms * 1000));
+}
+
+void delayMicroseconds(uint32_t us)
+{
+  std::this_thread::sleep_for(HostClock::toWallTime(us));
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {}
+
+void digitalWrite(uint8_t pin, uint8_t value) {}
+
+int digitalRead(uint8_t pin)
+{
+  return LOW;
+}
+
+uint16_t analogRead(uint8_t pin)
+{
+  return 4095;
+}
+
+void ledcSetup(uint8_t channel, double freq, uint8_t resolution) {}
+
+void ledcAttachPin(uint8_t pin, uint8_t channel) {}
+
+void ledcWrite(uint8_t channel, uint32_t duty) {}
+
+void *ps_malloc(size_t size)
+{
+  return malloc(size);
+}
+
+void *ps_calloc(size_t n, size_t size)
+{
+  return calloc(n, size);
+}
+
+void *ps_realloc(void *ptr, size_t size)
+{
+  return realloc(ptr, size);
+}
+
+void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+  return malloc(size);
+}
+
+void *heap_caps_calloc(size_t n, size_t size, uint32_t caps)
+{
+  return calloc(n, size);
+}
+
+void *heap_caps_realloc(void *ptr, size_t size, uint32_t caps)
+{
+  return realloc(ptr, size);
+}
+
+void heap_caps_free(void *ptr)
+{
+  free(ptr);
+}
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len)
+{
+  crc = ~crc;
+  for (uint32_t i = 0; i < len; i++)
+  {
+    crc ^= buf[i];
+    for (int bit = 0; bit < 8; bit++)
+    {
+      crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+  }
+  return ~crc;
+}
@@ -0,0 +1,306 @@
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include "HostClock.h"
+#include <Arduino.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct tskTaskControlBlock
+{
+  char name[configMAX_TASK_NAME_LEN];
+  BaseType_t core;
+  std::mutex lock;
+  std::condition_variable notified;
+  uint32_t notifyValue = 0;
+};
+
+struct QueueDefinition
+{
+  std::mutex lock;
+  // signalled whenever an item is added or removed
+  std::condition_variable changed;
+  UBaseType_t length;
+  UBaseType_t itemSize;
+  std::deque<std::vector<uint8_t>> items;
+  // for recursive mutexes
+  TaskHandle_t holder = NULL;
+  UBaseType_t depth = 0;
+};
+
+// thrown by vTaskDelete(NULL) to unwind the task's thread
+struct TaskDeleted
+{
+};
+
+static std::recursive_mutex criticalLock;
+static thread_local TaskHandle_t currentTask = NULL;
+
+// Wait on condition until ready() or the timeout, false on timeout
+template <typename Ready>
+static bool waitUntil(std::unique_lock<std::mutex> &lock,
+                      std::condition_variable &condition, TickType_t ticks,
+                      Ready ready)
+{
+  if (ticks == portMAX_DELAY)
+  {
+    condition.wait(lock, ready);
+    return true;
+  }
+  return condition.wait_for(
+      lock, HostClock::toWallTime((int64_t)ticks * portTICK_PERIOD_MS * 1000),
+      ready);
+}
+
+static TaskHandle_t createTaskControlBlock(const char *name, BaseType_t core)
+{
+  TaskHandle_t task = new tskTaskControlBlock();
+  strncpy(task->name, name, configMAX_TASK_NAME_LEN - 1);
+  task->name[configMAX_TASK_NAME_LEN - 1] = 0;
+  task->core = core == tskNO_AFFINITY ? 0 : core;
+  return task;
+}
+
+void vPortEnterCritical(portMUX_TYPE *mux)
+{
+  criticalLock.lock();
+}
+
+void vPortExitCritical(portMUX_TYPE *mux)
+{
+  criticalLock.unlock();
+}
+
+BaseType_t xPortGetCoreID()
+{
+  return xTaskGetCurrentTaskHandle()->core;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name,
+                                   uint32_t stackDepth, void *param,
+                                   UBaseType_t priority, TaskHandle_t *handle,
+                                   BaseType_t core)
+{
+  TaskHandle_t task = createTaskControlBlock(name, core);
+  if (handle)
+  {
+    *handle = task;
+  }
+  std::thread([=]()
+              {
+                currentTask = task;
+                try
+                {
+                  function(param);
+                }
+                catch (const TaskDeleted &)
+                {
+                } })
+      .detach();
+  return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name,
+                       uint32_t stackDepth, void *param, UBaseType_t priority,
+                       TaskHandle_t *handle)
+{
+  return xTaskCreatePinnedToCore(function, name, stackDepth, param, priority,
+                                 handle, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+  if (task != NULL && task != xTaskGetCurrentTaskHandle())
+  {
+    Serial.printf("vTaskDelete: can't delete %s from another task\n",
+                  task->name);
+    return;
+  }
+  throw TaskDeleted();
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+  delay(ticks * portTICK_PERIOD_MS);
+}
+
+TickType_t xTaskGetTickCount()
+{
+  return millis() / portTICK_PERIOD_MS;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle()
+{
+  if (!currentTask)
+  {
+    // the Arduino loop runs on core 1
+    currentTask = createTaskControlBlock("loopTask", 1);
+  }
+  return currentTask;
+}
+
+char *pcTaskGetName(TaskHandle_t task)
+{
+  return (task ? task : xTaskGetCurrentTaskHandle())->name;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+  std::lock_guard<std::mutex> lock(task->lock);
+  task->notifyValue++;
+  task->notified.notify_all();
+  return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks)
+{
+  TaskHandle_t task = xTaskGetCurrentTaskHandle();
+  std::unique_lock<std::mutex> lock(task->lock);
+  waitUntil(lock, task->notified, ticks,
+            [task]()
+            { return task->notifyValue > 0; });
+  uint32_t value = task->notifyValue;
+  if (value > 0)
+  {
+    task->notifyValue = clearOnExit ? 0 : value - 1;
+  }
+  return value;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize)
+{
+  QueueHandle_t queue = new QueueDefinition();
+  queue->length = length;
+  queue->itemSize = itemSize;
+  return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+  delete queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+  std::unique_lock<std::mutex> lock(queue->lock);
+  if (!waitUntil(lock, queue->changed, ticks, [queue]()
+                 { return queue->items.size() < queue->length; }))
+  {
+    return pdFALSE;
+  }
+  const uint8_t *bytes = (const uint8_t *)item;
+  queue->items.emplace_back(bytes, bytes + (item ? queue->itemSize : 0));
+  queue->changed.notify_all();
+  return pdTRUE;
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void *item,
+                            TickType_t ticks)
+{
+  return xQueueSend(queue, item, ticks);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+  std::unique_lock<std::mutex> lock(queue->lock);
+  if (!waitUntil(lock, queue->changed, ticks, [queue]()
+                 { return !queue->items.empty(); }))
+  {
+    return pdFALSE;
+  }
+  if (item && queue->itemSize > 0)
+  {
+    memcpy(item, queue->items.front().data(), queue->itemSize);
+  }
+  queue->items.pop_front();
+  queue->changed.notify_all();
+  return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+  std::lock_guard<std::mutex> lock(queue->lock);
+  return queue->items.size();
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue)
+{
+  std::lock_guard<std::mutex> lock(queue->lock);
+  return queue->length - queue->items.size();
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary()
+{
+  return xQueueCreate(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex()
+{
+  SemaphoreHandle_t mutex = xQueueCreate(1, 0);
+  xSemaphoreGive(mutex);
+  return mutex;
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex()
+{
+  return xSemaphoreCreateMutex();
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t maxCount,
+                                           UBaseType_t initialCount)
+{
+  SemaphoreHandle_t semaphore = xQueueCreate(maxCount, 0);
+  for (UBaseType_t i = 0; i < initialCount; i++)
+  {
+    xSemaphoreGive(semaphore);
+  }
+  return semaphore;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks)
+{
+  return xQueueReceive(semaphore, NULL, ticks);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+  return xQueueSend(semaphore, NULL, 0);
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t mutex, TickType_t ticks)
+{
+  TaskHandle_t task = xTaskGetCurrentTaskHandle();
+  std::unique_lock<std::mutex> lock(mutex->lock);
+  if (mutex->holder != task)
+  {
+    if (!waitUntil(lock, mutex->changed, ticks, [mutex]()
+                   { return !mutex->items.empty(); }))
+    {
+      return pdFALSE;
+    }
+    mutex->items.pop_front();
+    mutex->holder = task;
+  }
+  mutex->depth++;
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t mutex)
+{
+  std::lock_guard<std::mutex> lock(mutex->lock);
+  if (mutex->holder != xTaskGetCurrentTaskHandle())
+  {
+    return pdFALSE;
+  }
+  if (--mutex->depth == 0)
+  {
+    mutex->holder = NULL;
+    mutex->items.emplace_back();
+    mutex->changed.notify_all();
+  }
+  return pdTRUE;
+}
@@ -0,0 +1,53 @@
+#include "HostClock.h"
+#include <mutex>
+
+using WallClock = std::chrono::steady_clock;
+
+static std::mutex clockLock;
+static const WallClock::time_point wallStart = WallClock::now();
+static float clockSpeed = 1.0f;
+// clock time = offset + wall time since start * speed
+static double offsetUs = 0;
+
+static double wallUs()
+{
+  return std::chrono::duration<double, std::micro>(WallClock::now() - wallStart)
+      .count();
+}
+
+int64_t HostClock::nowUs()
+{
+  std::lock_guard<std::mutex> lock(clockLock);
+  return offsetUs + wallUs() * clockSpeed;
+}
+
+void HostClock::setSpeed(float speed)
+{
+  if (speed <= 0)
+  {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(clockLock);
+  // carry on from the current time at the new speed
+  double wall = wallUs();
+  double now = offsetUs + wall * clockSpeed;
+  clockSpeed = speed;
+  offsetUs = now - wall * clockSpeed;
+}
+
+float HostClock::getSpeed()
+{
+  std::lock_guard<std::mutex> lock(clockLock);
+  return clockSpeed;
+}
+
+void HostClock::advance(int64_t us)
+{
+  std::lock_guard<std::mutex> lock(clockLock);
+  offsetUs += us;
+}
+
+std::chrono::microseconds HostClock::toWallTime(int64_t us)
+{
+  return std::chrono::microseconds((int64_t)(us / getSpeed()));
+}
@@ -0,0 +1,37 @@
+#include <Preferences.h>
+
+bool Preferences::clear()
+{
+  ints.clear();
+  strings.clear();
+  return true;
+}
+
+bool Preferences::isKey(const char *key)
+{
+  return ints.count(key) > 0 || strings.count(key) > 0;
+}
+
+int32_t Preferences::getInt(const char *key, int32_t defaultValue)
+{
+  auto it = ints.find(key);
+  return it == ints.end() ? defaultValue : it->second;
+}
+
+size_t Preferences::putInt(const char *key, int32_t value)
+{
+  ints[key] = value;
+  return sizeof(value);
+}
+
+String Preferences::getString(const char *key, String defaultValue)
+{
+  auto it = strings.find(key);
+  return it == strings.end() ? defaultValue : it->second;
+}
+
+size_t Preferences::putString(const char *key, String value)
+{
+  strings[key] = value;
+  return value.length();
+}
@@ -0,0 +1,59 @@
+#include <Arduino.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "MediaCatalog.h"
+#include "SDCard.h"
+
+// The card is a directory on the host, SDCARD_ROOT or ./sdcard. Paths are
+// returned under it, just as they are under /sdcard on the device.
+static std::string mountPoint()
+{
+  const char *root = getenv("SDCARD_ROOT");
+  return root ? root : "sdcard";
+}
+
+SDCard::SDCard(gpio_num_t miso, gpio_num_t mosi, gpio_num_t clk, gpio_num_t cs)
+{
+  struct stat info;
+  sd_card_init_success =
+      stat(mountPoint().c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+  if (!sd_card_init_success)
+  {
+    Serial.printf("No card directory at %s\n", mountPoint().c_str());
+  }
+}
+
+SDCard::SDCard(gpio_num_t clk, gpio_num_t cmd, gpio_num_t d0, gpio_num_t d1,
+               gpio_num_t d2, gpio_num_t d3)
+    : SDCard(d0, cmd, clk, d3)
+{
+}
+
+SDCard::~SDCard() {}
+
+bool SDCard::isMounted()
+{
+  return sd_card_init_success;
+}
+
+std::string SDCard::getMountPoint()
+{
+  return mountPoint();
+}
+
+// host file systems keep folder times up to date, which is all the catalog
+// needs to see changes
+uint64_t SDCard::getFreeBytes()
+{
+  return 0;
+}
+
+MediaCatalog *SDCard::getCatalog()
+{
+  if (!m_catalog)
+  {
+    m_catalog = new MediaCatalog(this);
+    m_catalog->load();
+  }
+  return m_catalog;
+}
@@ -0,0 +1,206 @@
+#include <TFT_eSPI.h>
+
+static TFT_eSPI *lastPanel = NULL;
+
+TFT_eSPI::TFT_eSPI(int16_t w, int16_t h) : _width(w), _height(h) {}
+
+TFT_eSPI::~TFT_eSPI()
+{
+  free(panel);
+}
+
+void TFT_eSPI::init()
+{
+  if (!panel)
+  {
+    panel = (uint16_t *)calloc(_width * _height, 2);
+  }
+  lastPanel = this;
+}
+
+TFT_eSPI *TFT_eSPI::getPanel()
+{
+  return lastPanel;
+}
+
+void TFT_eSPI::setRotation(uint8_t rotation)
+{
+  // landscape rotations swap the sides, the buffer stays the same size
+  bool landscape = rotation & 1;
+  int16_t shortSide = min(_width, _height);
+  int16_t longSide = max(_width, _height);
+  _width = landscape ? longSide : shortSide;
+  _height = landscape ? shortSide : longSide;
+}
+
+// Copy a block of pixels into dest, clipped to its bounds
+void TFT_eSPI::writeRect(uint16_t *dest, int16_t destWidth,
+                         int16_t destHeight, int32_t x, int32_t y, int32_t w,
+                         int32_t h, const uint16_t *pixels)
+{
+  if (!dest)
+  {
+    return;
+  }
+  int32_t left = max(x, (int32_t)0);
+  int32_t right = min(x + w, (int32_t)destWidth);
+  for (int32_t row = max(y, (int32_t)0); row < min(y + h, (int32_t)destHeight);
+       row++)
+  {
+    if (left < right)
+    {
+      memcpy(dest + row * destWidth + left,
+             pixels + (row - y) * w + (left - x), (right - left) * 2);
+    }
+  }
+}
+
+void TFT_eSPI::fillScreen(uint32_t color)
+{
+  fillRect(0, 0, _width, _height, color);
+}
+
+void TFT_eSPI::fillRect(int32_t x, int32_t y, int32_t w, int32_t h,
+                        uint32_t color)
+{
+  if (!panel)
+  {
+    return;
+  }
+  for (int32_t row = max(y, (int32_t)0); row < min(y + h, (int32_t)_height);
+       row++)
+  {
+    for (int32_t col = max(x, (int32_t)0); col < min(x + w, (int32_t)_width);
+         col++)
+    {
+      panel[row * _width + col] = color;
+    }
+  }
+}
+
+void TFT_eSPI::pushImage(int32_t x, int32_t y, int32_t w, int32_t h,
+                         uint16_t *data)
+{
+  writeRect(panel, _width, _height, x, y, w, h, data);
+}
+
+void TFT_eSPI::readRect(int32_t x, int32_t y, int32_t w, int32_t h,
+                        uint16_t *data)
+{
+  for (int32_t row = 0; row < h; row++)
+  {
+    for (int32_t col = 0; col < w; col++)
+    {
+      bool inside = panel && x + col >= 0 && x + col < _width && y + row >= 0 &&
+                    y + row < _height;
+      data[row * w + col] =
+          inside ? panel[(y + row) * _width + x + col] : TFT_BLACK;
+    }
+  }
+}
+
+void TFT_eSPI::setAddrWindow(int32_t x, int32_t y, int32_t w, int32_t h)
+{
+  windowX = x;
+  windowY = y;
+  windowWidth = w;
+  windowHeight = h;
+  windowPos = 0;
+}
+
+// Pixels fill the address window row by row, as they would on the panel
+void TFT_eSPI::pushPixels(const void *data, uint32_t len)
+{
+  const uint16_t *pixels = (const uint16_t *)data;
+  for (uint32_t i = 0; i < len && windowWidth > 0; i++)
+  {
+    int32_t x = windowX + windowPos % windowWidth;
+    int32_t y = windowY + windowPos / windowWidth;
+    if (panel && x >= 0 && x < _width && y >= 0 && y < _height)
+    {
+      panel[y * _width + x] = pixels[i];
+    }
+    windowPos = (windowPos + 1) % (windowWidth * windowHeight);
+  }
+}
+
+// Only font sizes, there are no glyphs
+int16_t TFT_eSPI::fontWidth()
+{
+  switch (textFont)
+  {
+  case 2:
+    return 8 * textSize;
+  case 4:
+    return 14 * textSize;
+  default:
+    return 6 * textSize;
+  }
+}
+
+int16_t TFT_eSPI::textWidth(const char *text)
+{
+  return strlen(text) * fontWidth();
+}
+
+int16_t TFT_eSPI::fontHeight()
+{
+  switch (textFont)
+  {
+  case 2:
+    return 16 * textSize;
+  case 4:
+    return 26 * textSize;
+  default:
+    return 8 * textSize;
+  }
+}
+
+TFT_eSprite::TFT_eSprite(TFT_eSPI *tft) : TFT_eSPI(0, 0), tft(tft) {}
+
+TFT_eSprite::~TFT_eSprite()
+{
+  deleteSprite();
+}
+
+void *TFT_eSprite::createSprite(int16_t w, int16_t h, uint8_t frames)
+{
+  deleteSprite();
+  pixels = (uint16_t *)calloc(w * h, 2);
+  if (pixels)
+  {
+    _width = w;
+    _height = h;
+  }
+  return pixels;
+}
+
+void TFT_eSprite::deleteSprite()
+{
+  free(pixels);
+  pixels = NULL;
+  _width = 0;
+  _height = 0;
+}
+
+void TFT_eSprite::fillSprite(uint32_t color)
+{
+  for (int32_t i = 0; pixels && i < _width * _height; i++)
+  {
+    pixels[i] = color;
+  }
+}
+
+void TFT_eSprite::pushImage(int32_t x, int32_t y, int32_t w, int32_t h,
+                            uint16_t *data)
+{
+  writeRect(pixels, _width, _height, x, y, w, h, data);
+}
+
+void TFT_eSprite::pushSprite(int32_t x, int32_t y)
+{
+  if (pixels)
+  {
+    tft->pushImage(x, y, _width, _height, pixels);
+  }
+}
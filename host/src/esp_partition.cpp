@@ -0,0 +1,108 @@
+#include <esp_partition.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+// same size as the spiffs partition in default_16MB.csv
+const uint32_t MEDIA_PARTITION_SIZE = 0xA10000;
+const size_t FLASH_SECTOR_SIZE = 4096;
+
+static esp_partition_t mediaPartition = {
+    ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, 0x5F0000,
+    MEDIA_PARTITION_SIZE, "spiffs", false};
+static std::vector<uint8_t> contents;
+
+static void load()
+{
+  if (!contents.empty())
+  {
+    return;
+  }
+  // erased flash reads as all ones
+  contents.assign(MEDIA_PARTITION_SIZE, 0xff);
+  const char *path = getenv("FLASH_IMAGE");
+  FILE *f = fopen(path ? path : "flash.bin", "rb");
+  if (f)
+  {
+    fread(contents.data(), 1, contents.size(), f);
+    fclose(f);
+  }
+}
+
+static bool inRange(const esp_partition_t *partition, size_t offset,
+                    size_t size)
+{
+  return partition == &mediaPartition && offset <= partition->size &&
+         size <= partition->size - offset;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type,
+                                                esp_partition_subtype_t subtype,
+                                                const char *label)
+{
+  if (type != mediaPartition.type ||
+      (subtype != ESP_PARTITION_SUBTYPE_ANY &&
+       subtype != mediaPartition.subtype) ||
+      (label && strcmp(label, mediaPartition.label) != 0))
+  {
+    return NULL;
+  }
+  load();
+  return &mediaPartition;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition,
+                             size_t src_offset, void *dst, size_t size)
+{
+  if (!inRange(partition, src_offset, size))
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  memcpy(dst, contents.data() + src_offset, size);
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition,
+                              size_t dst_offset, const void *src, size_t size)
+{
+  if (!inRange(partition, dst_offset, size))
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  // writing can only clear bits, like NOR flash
+  const uint8_t *bytes = (const uint8_t *)src;
+  for (size_t i = 0; i < size; i++)
+  {
+    contents[dst_offset + i] &= bytes[i];
+  }
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition,
+                                    size_t offset, size_t size)
+{
+  if (!inRange(partition, offset, size) || offset % FLASH_SECTOR_SIZE != 0 ||
+      size % FLASH_SECTOR_SIZE != 0)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  memset(contents.data() + offset, 0xff, size);
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t *partition, size_t offset,
+                             size_t size, spi_flash_mmap_memory_t memory,
+                             const void **out_ptr,
+                             spi_flash_mmap_handle_t *out_handle)
+{
+  if (!inRange(partition, offset, size))
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  *out_ptr = contents.data() + offset;
+  *out_handle = 1;
+  return ESP_OK;
+}
+
+void spi_flash_munmap(spi_flash_mmap_handle_t handle) {}
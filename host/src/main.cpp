@@ -0,0 +1,103 @@
+// Plays the AVI files in a host directory headless and reports how well each
+// stage of the pipeline keeps up, without a board:
+//
+//   SDCARD_ROOT=clips .pio/build/native/program [seconds] [clock speed]
+//
+// Playback stops after the given number of seconds of clock time, or once
+// every file has played. A clock speed above 1 runs the presentation clock
+// faster than real time, which also scales the reported timings.
+
+#include "Battery.h"
+#include "Display.h"
+#include "HostClock.h"
+#include "Metrics.h"
+#include "Prefs.h"
+#include "SDCard.h"
+#include "VideoPlayer/SDCardVideoSource.h"
+#include "VideoPlayer/VideoPlayer.h"
+#include <Arduino.h>
+#include <unistd.h>
+
+// how often progress is printed, in clock time
+const int REPORT_INTERVAL_MS = 1000;
+
+static void printMetrics()
+{
+  for (int i = 0; i < (int)Metric::COUNT; i++)
+  {
+    MetricSummary summary = Metrics::summarize((Metric)i);
+    Serial.printf("  %-16s p50 %7u  p90 %7u  p99 %7u  max %7u  (%d samples)\n",
+                  Metrics::getName((Metric)i), summary.p50, summary.p90,
+                  summary.p99, summary.max, summary.samples);
+  }
+  for (int i = 0; i < (int)Counter::COUNT; i++)
+  {
+    Serial.printf("  %-16s %u\n", Metrics::getName((Counter)i),
+                  Metrics::getCount((Counter)i));
+  }
+}
+
+int main(int argc, char **argv)
+{
+  int seconds = argc > 1 ? atoi(argv[1]) : 0;
+  if (argc > 2)
+  {
+    HostClock::setSpeed(atof(argv[2]));
+  }
+
+  Prefs prefs;
+  prefs.begin();
+  Display display(&prefs);
+  Battery battery(0, 3.3, 200000.0, 100000.0);
+  battery.begin();
+
+  SDCard card(0, 0, 0, 0);
+  if (!card.isMounted())
+  {
+    return 1;
+  }
+  SDCardVideoSource *source = new SDCardVideoSource(&card, "/");
+  if (!source->fetchVideoData())
+  {
+    return 1;
+  }
+  VideoPlayer *player = new VideoPlayer(source, display, prefs, battery);
+  player->start();
+  player->set(0);
+  player->play();
+
+  unsigned long start = millis();
+  unsigned long lastReport = start;
+  uint32_t lastPresented = 0;
+  while (seconds == 0 || millis() - start < (unsigned long)seconds * 1000)
+  {
+    delay(10);
+    if (source->consumeWrapped())
+    {
+      break;
+    }
+    unsigned long now = millis();
+    if (now - lastReport >= REPORT_INTERVAL_MS)
+    {
+      PresentationClockStats stats = source->getClockStats();
+      Serial.printf("%s: %.1f fps, %u late, %u dropped, jitter %u us\n",
+                    source->getChannelName().c_str(),
+                    (stats.presentedFrames - lastPresented) * 1000.0f /
+                        (now - lastReport),
+                    stats.lateFrames, stats.droppedFrames, stats.jitterUs);
+      lastPresented = stats.presentedFrames;
+      lastReport = now;
+    }
+  }
+  player->stop();
+
+  PresentationClockStats stats = source->getClockStats();
+  FlushStats flush = display.getFlushStats();
+  Serial.printf("\n%u frames in %lu ms, %u late, %u dropped, %u flushes\n",
+                stats.presentedFrames, millis() - start, stats.lateFrames,
+                stats.droppedFrames, flush.flushes);
+  printMetrics();
+  // the tasks never return, leave without tearing down what they use
+  fflush(stdout);
+  _exit(0);
+}
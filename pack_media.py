@@ -0,0 +1,128 @@
+# pack_media.py
+#
+# Packs MJPEG AVI files and JPEG images into a media image for the flash
+# partition the firmware doesn't otherwise use (see FlashLibrary.h for the
+# layout). Boards without an SD card play it in place of streaming.
+#
+#   python pack_media.py media.bin intro.avi logo.jpg ...
+#
+# Upload media.bin from the Firmware tab of the web page, or write it
+# directly with esptool:
+#
+#   esptool.py write_flash 0x5F0000 media.bin
+
+import os
+import struct
+import sys
+
+VERSION = 1
+# size of the spiffs partition in default_16MB.csv
+PARTITION_SIZE = 0xA10000
+NAME_LENGTH = 32
+HEADER = struct.Struct("<4sIII")
+ENTRY = struct.Struct("<32sIIIII")
+FRAME = struct.Struct("<II")
+VIDEO = 0
+IMAGE = 1
+
+
+def read_chunks(data, start, end):
+    """
+    Yields (id, offset, length) for the RIFF chunks between start and end.
+    """
+    pos = start
+    while pos + 8 <= end:
+        chunk_id, length = struct.unpack_from("<4sI", data, pos)
+        yield chunk_id, pos + 8, length
+        pos += 8 + length + (length & 1)
+
+
+def read_avi(path):
+    """
+    Returns the video stream's rate, scale and frames of an AVI file.
+    """
+    with open(path, "rb") as f:
+        data = f.read()
+    if data[0:4] != b"RIFF" or data[8:12] != b"AVI ":
+        raise ValueError("not an AVI file")
+    rate, scale = 0, 0
+    video_stream = None
+    frames = []
+
+    def walk(start, end, stream_index):
+        nonlocal rate, scale, video_stream
+        for chunk_id, offset, length in read_chunks(data, start, end):
+            if chunk_id == b"LIST":
+                kind = data[offset:offset + 4]
+                if kind == b"strl":
+                    stream_index[0] += 1
+                walk(offset + 4, offset + length, stream_index)
+            elif chunk_id == b"strh" and data[offset:offset + 4] == b"vids":
+                if video_stream is None:
+                    video_stream = stream_index[0]
+                    scale, rate = struct.unpack_from("<II", data, offset + 20)
+            elif (video_stream is not None and
+                  chunk_id[2:4] in (b"dc", b"db") and
+                  chunk_id[0:2] == b"%02d" % video_stream):
+                frames.append(data[offset:offset + length])
+
+    walk(12, len(data), [-1])
+    if video_stream is None or scale == 0:
+        raise ValueError("no video stream")
+    return rate, scale, frames
+
+
+def pack(paths):
+    entries = []
+    for path in paths:
+        name = os.path.basename(path).encode()[:NAME_LENGTH]
+        if path.lower().endswith(".avi"):
+            rate, scale, frames = read_avi(path)
+            entries.append((name, VIDEO, rate, scale, frames))
+        else:
+            with open(path, "rb") as f:
+                entries.append((name, IMAGE, 0, 1, [f.read()]))
+        print("%-32s %5d frames" % (name.decode(), len(entries[-1][4])))
+
+    # header, entries, every frame table, then the frames themselves, each
+    # word aligned
+    offset = HEADER.size + ENTRY.size * len(entries)
+    table_offsets = []
+    for entry in entries:
+        table_offsets.append(offset)
+        offset += FRAME.size * len(entry[4])
+    tables = b""
+    payload = bytearray()
+    data_start = offset
+    for entry in entries:
+        for frame in entry[4]:
+            tables += FRAME.pack(data_start + len(payload), len(frame))
+            payload += frame
+            payload += b"\0" * (-len(payload) % 4)
+    length = data_start + len(payload)
+
+    image = HEADER.pack(b"TTMI", VERSION, length, len(entries))
+    for entry, table_offset in zip(entries, table_offsets):
+        name, media_type, rate, scale, frames = entry
+        image += ENTRY.pack(name, media_type, rate, scale, len(frames),
+                            table_offset)
+    return image + tables + bytes(payload)
+
+
+def main():
+    if len(sys.argv) < 3:
+        print("usage: %s <output> <file.avi|file.jpg> ..." % sys.argv[0])
+        sys.exit(2)
+    image = pack(sys.argv[2:])
+    if len(image) > PARTITION_SIZE:
+        print("Image is %d bytes, the partition only holds %d" %
+              (len(image), PARTITION_SIZE))
+        sys.exit(1)
+    with open(sys.argv[1], "wb") as f:
+        f.write(image)
+    print("Wrote %d bytes, %d%% of the partition" %
+          (len(image), len(image) * 100 // PARTITION_SIZE))
+
+
+if __name__ == "__main__":
+    main()
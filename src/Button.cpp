@@ -74,7 +74,7 @@ void Button::update()
   {
     Serial.println("Long Press");
     longPressDetected = true;
-    digitalWrite(_sys_en_pin, LOW);
+    powerOff();
   }
 
   if (clickCount > 0 && (millis() - lastClickTime) >= clickInterval)
@@ -107,5 +107,14 @@ bool Button::isDoubleClicked()
 
 void Button::powerOff()
 {
+  if (powerOffCallback)
+  {
+    powerOffCallback();
+  }
   digitalWrite(_sys_en_pin, LOW);
 }
+
+void Button::onPowerOff(std::function<void()> callback)
+{
+  powerOffCallback = callback;
+}
@@ -2,6 +2,7 @@
 #define BUTTON_H
 
 #include <Arduino.h>
+#include <functional>
 
 class Button
 {
@@ -12,6 +13,8 @@ public:
   bool isClicked();
   bool isDoubleClicked();
   void powerOff();
+  // called before the power is cut, on a long press or powerOff()
+  void onPowerOff(std::function<void()> callback);
 
 private:
   int _pin;
@@ -30,6 +33,8 @@ private:
   bool doubleClickDetected;
 
   int clickCount;
+
+  std::function<void()> powerOffCallback;
 };
 
 #endif // BUTTON_H
@@ -1,25 +1,46 @@
 #include <Arduino.h>
 #include <TFT_eSPI.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
 #include "Display.h"
+#include "Metrics.h"
+#include "Trace.h"
 
 // PWM channel for backlight
 #define LEDC_CHANNEL_0 0
 #define LEDC_TIMER_8_BIT 8
 #define LEDC_BASE_FREQ 5000
 
+// the MediaPlayer task decodes on core 1, so push pixels from core 0
+const int FLUSH_TASK_CORE = 0;
+// height of the stripes frames are sent in over DMA, at least a JPEG MCU row
+const int DMA_STRIPE_LINES = 16;
+
 Display::Display(Prefs *prefs) : tft(new TFT_eSPI()), _prefs(prefs)
 {
   tft_mutex = xSemaphoreCreateRecursiveMutex();
+  sprite_mutex = xSemaphoreCreateRecursiveMutex();
+  overlay_mutex = xSemaphoreCreateRecursiveMutex();
+  flushQueue = xQueueCreate(1, sizeof(TFT_eSprite *));
+  flushIdle = xSemaphoreCreateBinary();
+  xSemaphoreGive(flushIdle);
 
   // First, initialize the TFT itself and set the rotation
   tft->init();
   tft->setRotation(3);
 
-  // Now create the sprite with the correct, rotated dimensions
-  frameSprite = new TFT_eSprite(tft);
-  frameSprite->createSprite(tft->width(), tft->height());
-  frameSprite->setTextFont(2);
-  frameSprite->setTextSize(2);
+#ifdef STRIPE_RENDER
+  stripeMode = true;
+#else
+  // Now create the sprites with the correct, rotated dimensions
+  frameSprites[0] = createFrameSprite();
+  // with a second sprite the next frame can be decoded while this one is
+  // sent, without it presentSprite falls back to a blocking flush
+  frameSprites[1] = createFrameSprite();
+  // without room for a full frame, stream stripes to the panel instead
+  stripeMode = frameSprites[0] == NULL;
+#endif
+  frameSprite = frameSprites[0];
 
 // setup the backlight
 #ifdef TFT_BL
@@ -30,13 +51,62 @@ Display::Display(Prefs *prefs) : tft(new TFT_eSPI()), _prefs(prefs)
   tft->fillScreen(TFT_BLACK);
 #ifdef USE_DMA
   tft->initDMA();
+  dmaEnabled = true;
 #endif
+  // frames are composited with the OSD a stripe at a time on their way out.
+  // The sprites live in PSRAM, which the SPI DMA can't read from.
+  dmaBufferPixels = tft->width() * DMA_STRIPE_LINES;
+  for (int i = 0; i < 2; i++)
+  {
+    dmaBuffer[i] = (uint16_t *)heap_caps_malloc(dmaBufferPixels * 2,
+                                                MALLOC_CAP_DMA);
+  }
+  if (!dmaBuffer[0] || !dmaBuffer[1])
+  {
+    dmaBufferPixels = 0;
+    dmaEnabled = false;
+  }
   tft->fillScreen(TFT_BLACK);
   tft->setTextFont(2);
   tft->setTextSize(2);
   tft->setTextColor(TFT_GREEN, TFT_BLACK);
 }
 
+TFT_eSprite *Display::createFrameSprite()
+{
+  TFT_eSprite *sprite = new TFT_eSprite(tft);
+  if (sprite->createSprite(tft->width(), tft->height()) == NULL)
+  {
+    delete sprite;
+    return NULL;
+  }
+  sprite->setTextFont(2);
+  sprite->setTextSize(2);
+  return sprite;
+}
+
+void Display::_flushTask(void *param)
+{
+  Display *display = (Display *)param;
+  display->flushTask();
+}
+
+void Display::flushTask()
+{
+  TFT_eSprite *sprite;
+  while (true)
+  {
+    if (xQueueReceive(flushQueue, &sprite, portMAX_DELAY) == pdTRUE)
+    {
+      int index = sprite == frameSprites[0] ? 0 : 1;
+      xSemaphoreTakeRecursive(tft_mutex, portMAX_DELAY);
+      pushFrame(sprite, fullFrame[index] ? NULL : &dirtyRects[index]);
+      xSemaphoreGiveRecursive(tft_mutex);
+      xSemaphoreGive(flushIdle);
+    }
+  }
+}
+
 void Display::setBrightness(uint8_t brightness)
 {
 #ifdef TFT_BL
@@ -44,45 +114,449 @@ void Display::setBrightness(uint8_t brightness)
 #endif
 }
 
+// Send pixels to the current address window, a DMA transfer is left running
+void Display::pushStripe(uint16_t *pixels, int numPixels)
+{
+  if (dmaEnabled)
+  {
+    // pushPixelsDMA waits for the previous stripe before queueing this one,
+    // so the buffer filled next is never still on the wire
+    tft->pushPixelsDMA(pixels, numPixels);
+  }
+  else
+  {
+    tft->pushPixels(pixels, numPixels);
+  }
+}
+
+// Copy the overlay patches that intersect region into pixels, which holds
+// the region row by row
+void Display::compositeOverlay(uint16_t *pixels, DisplayRect region)
+{
+  for (const auto &patch : overlay)
+  {
+    int patchWidth = patch.sprite->width();
+    int patchHeight = patch.sprite->height();
+    int top = max(patch.y, region.y);
+    int bottom = min(patch.y + patchHeight, region.y + region.height);
+    int left = max(patch.x, region.x);
+    int right = min(patch.x + patchWidth, region.x + region.width);
+    if (left >= right)
+    {
+      continue;
+    }
+    uint16_t *src = (uint16_t *)patch.sprite->getPointer();
+    for (int row = top; row < bottom; row++)
+    {
+      memcpy(pixels + (row - region.y) * region.width + left - region.x,
+             src + (row - patch.y) * patchWidth + left - patch.x,
+             (right - left) * 2);
+    }
+  }
+}
+
+// Send part of a sprite with the overlay on top, must be called with
+// tft_mutex held. Returns the number of pixels sent.
+int Display::pushRegion(TFT_eSprite *sprite, DisplayRect region)
+{
+  int w = width();
+  int h = height();
+  int left = max(region.x, 0);
+  int top = max(region.y, 0);
+  int right = min(region.x + region.width, w);
+  int bottom = min(region.y + region.height, h);
+  if (left >= right || top >= bottom)
+  {
+    return 0;
+  }
+  if (dmaBufferPixels == 0)
+  {
+    // nowhere to composite, draw the overlay over the frame instead
+    sprite->pushSprite(0, 0);
+    drawOverlay();
+    return w * h;
+  }
+  region = {.x = left, .y = top, .width = right - left, .height = bottom - top};
+  uint16_t *pixels = (uint16_t *)sprite->getPointer();
+  int stripeLines = dmaBufferPixels / region.width;
+  tft->startWrite();
+  tft->dmaWait();
+  tft->setAddrWindow(region.x, region.y, region.width, region.height);
+  for (int y = top; y < bottom; y += stripeLines)
+  {
+    int lines = min(stripeLines, bottom - y);
+    uint16_t *stripe = dmaBuffer[dmaBufferIndex];
+    for (int row = 0; row < lines; row++)
+    {
+      memcpy(stripe + row * region.width, pixels + (y + row) * w + left,
+             region.width * 2);
+    }
+    xSemaphoreTakeRecursive(overlay_mutex, portMAX_DELAY);
+    compositeOverlay(stripe, {.x = left, .y = y, .width = region.width,
+                              .height = lines});
+    xSemaphoreGiveRecursive(overlay_mutex);
+    pushStripe(stripe, region.width * lines);
+    dmaBufferIndex = 1 - dmaBufferIndex;
+  }
+  tft->dmaWait();
+  tft->endWrite();
+  return region.width * region.height;
+}
+
+// Push a frame sprite to the panel, only the given regions of it unless
+// regions is NULL. Must be called with tft_mutex held.
+void Display::pushFrame(TFT_eSprite *sprite,
+                        const std::vector<DisplayRect> *regions)
+{
+  TRACE_SCOPE("flush");
+  int64_t start = esp_timer_get_time();
+  uint32_t pixels = 0;
+  if (regions == NULL || dmaBufferPixels == 0)
+  {
+    pixels = pushRegion(sprite, {.x = 0, .y = 0, .width = width(),
+                                 .height = height()});
+  }
+  else
+  {
+    for (const auto &rect : *regions)
+    {
+      pixels += pushRegion(sprite, rect);
+    }
+  }
+  displayedSprite = sprite;
+  flushStats.lastPixelsPushed = pixels;
+  flushStats.averagePixelsPushed +=
+      ((int32_t)pixels - (int32_t)flushStats.averagePixelsPushed) / 16;
+  uint32_t elapsed = esp_timer_get_time() - start;
+  Metrics::record(Metric::FLUSH_US, elapsed);
+  Metrics::record(Metric::PIXELS_PUSHED, pixels);
+  flushStats.flushes++;
+  flushStats.lastFlushUs = elapsed;
+  flushStats.averageFlushUs += ((int32_t)elapsed - (int32_t)flushStats.averageFlushUs) / 16;
+  if (elapsed > flushStats.maxFlushUs)
+  {
+    flushStats.maxFlushUs = elapsed;
+  }
+}
+
 // this function now draws directly to the screen, used for non-buffered drawing
 void Display::drawPixels(int x, int y, int width, int height, uint16_t *pixels)
 {
   int numPixels = width * height;
-  if (dmaBuffer[dmaBufferIndex] == NULL)
-  {
-    dmaBuffer[dmaBufferIndex] = (uint16_t *)malloc(numPixels * 2);
-  }
-  memcpy(dmaBuffer[dmaBufferIndex], pixels, numPixels * 2);
   xSemaphoreTakeRecursive(tft_mutex, portMAX_DELAY);
+  // the panel no longer matches any frame sprite
+  panelSprite = NULL;
+  tft->startWrite();
   tft->setAddrWindow(x, y, width, height);
-#ifdef USE_DMA
-  tft->pushPixelsDMA(dmaBuffer[dmaBufferIndex], numPixels);
-#else
-  tft->pushPixels(dmaBuffer[dmaBufferIndex], numPixels);
-#endif
+  if (dmaEnabled && numPixels <= dmaBufferPixels)
+  {
+    memcpy(dmaBuffer[dmaBufferIndex], pixels, numPixels * 2);
+    tft->pushPixelsDMA(dmaBuffer[dmaBufferIndex], numPixels);
+    tft->dmaWait();
+    dmaBufferIndex = 1 - dmaBufferIndex;
+  }
+  else
+  {
+    tft->pushPixels(pixels, numPixels);
+  }
+  tft->endWrite();
   xSemaphoreGiveRecursive(tft_mutex);
-  dmaBufferIndex = (dmaBufferIndex + 1) % 2;
 }
 
 // new function to draw to our framebuffer sprite
 void Display::drawPixelsToSprite(int x, int y, int width, int height, uint16_t *pixels)
 {
+  if (stripeMode)
+  {
+    drawPixelsToStripe(x, y, width, height, pixels);
+    return;
+  }
   frameSprite->pushImage(x, y, width, height, pixels);
 }
 
+// JPEGDEC hands us an MCU row at a time, left to right, so blocks are
+// gathered into a full width stripe which is sent once the next row starts
+void Display::drawPixelsToStripe(int x, int y, int width, int height,
+                                 uint16_t *pixels)
+{
+  int screenWidth = tft->width();
+  if (y != stripeY)
+  {
+    sendStripe();
+    if (height * screenWidth > dmaBufferPixels)
+    {
+      return;
+    }
+    stripeY = y;
+    stripeLines = height;
+    // anything the image doesn't cover is black
+    memset(dmaBuffer[dmaBufferIndex], 0, height * screenWidth * 2);
+  }
+  // the image may be wider than the screen
+  int left = max(x, 0);
+  int right = min(x + width, screenWidth);
+  if (right <= left || height > stripeLines)
+  {
+    return;
+  }
+  uint16_t *stripe = dmaBuffer[dmaBufferIndex];
+  for (int row = 0; row < height; row++)
+  {
+    memcpy(stripe + row * screenWidth + left, pixels + row * width + left - x,
+           (right - left) * 2);
+  }
+}
+
+void Display::sendStripe()
+{
+  if (stripeY < 0)
+  {
+    return;
+  }
+  int screenWidth = tft->width();
+  int lines = min(stripeLines, tft->height() - stripeY);
+  uint16_t *stripe = dmaBuffer[dmaBufferIndex];
+  int top = stripeY;
+  stripeY = -1;
+  if (lines <= 0)
+  {
+    return;
+  }
+  // composite the OSD over the stripe
+  xSemaphoreTakeRecursive(overlay_mutex, portMAX_DELAY);
+  compositeOverlay(stripe, {.x = 0, .y = top, .width = screenWidth,
+                            .height = lines});
+  xSemaphoreGiveRecursive(overlay_mutex);
+  if (!stripeWriting)
+  {
+    // hold the panel until the whole frame has been sent
+    xSemaphoreTakeRecursive(tft_mutex, portMAX_DELAY);
+    tft->startWrite();
+    stripeWriting = true;
+  }
+  // the previous stripe has to be on the panel before we move the window,
+  // this stripe goes out while the decoder fills the other buffer
+  tft->dmaWait();
+  tft->setAddrWindow(0, top, screenWidth, lines);
+  pushStripe(stripe, screenWidth * lines);
+  dmaBufferIndex = 1 - dmaBufferIndex;
+}
+
+void Display::flushStripes()
+{
+  if (!stripeMode)
+  {
+    return;
+  }
+  sendStripe();
+  if (stripeWriting)
+  {
+    tft->dmaWait();
+    tft->endWrite();
+    stripeWriting = false;
+    xSemaphoreGiveRecursive(tft_mutex);
+  }
+}
+
+bool Display::commitOverlay()
+{
+  xSemaphoreTakeRecursive(overlay_mutex, portMAX_DELAY);
+  bool changed = pendingOsd.size() != overlayOsd.size();
+  for (int i = 0; !changed && i < (int)pendingOsd.size(); i++)
+  {
+    changed = pendingOsd[i].text != overlayOsd[i].text ||
+              pendingOsd[i].position != overlayOsd[i].position;
+  }
+  if (changed)
+  {
+    for (auto &patch : overlay)
+    {
+      patch.sprite->deleteSprite();
+      delete patch.sprite;
+    }
+    overlay.clear();
+    // render each OSD once, it's copied into every stripe it covers
+    for (const auto &osd : pendingOsd)
+    {
+      int textWidth = tft->textWidth(osd.text.c_str());
+      int textHeight = tft->fontHeight();
+      TFT_eSprite *sprite = new TFT_eSprite(tft);
+      if (sprite->createSprite(textWidth, textHeight) == NULL)
+      {
+        delete sprite;
+        continue;
+      }
+      sprite->setTextFont(2);
+      sprite->setTextSize(2);
+      sprite->setTextColor(TFT_ORANGE, TFT_BLACK);
+      sprite->fillSprite(TFT_BLACK);
+      sprite->setCursor(0, 0);
+      sprite->print(osd.text.c_str());
+      OverlayPatch patch = {.x = 0, .y = 0, .sprite = sprite};
+      getOSDOrigin(osd.position, textWidth, textHeight, patch.x, patch.y);
+      overlay.push_back(patch);
+    }
+    overlayOsd = pendingOsd;
+  }
+  pendingOsd.clear();
+  xSemaphoreGiveRecursive(overlay_mutex);
+  return changed;
+}
+
+bool Display::updateOverlay()
+{
+  if (stripeMode || displayedSprite == NULL)
+  {
+    return false;
+  }
+  waitForFlush();
+  std::vector<DisplayRect> dirty;
+  bool changed = commitOverlay(dirty);
+  if (changed)
+  {
+    xSemaphoreTakeRecursive(tft_mutex, portMAX_DELAY);
+    for (const auto &rect : dirty)
+    {
+      pushRegion(displayedSprite, rect);
+    }
+    xSemaphoreGiveRecursive(tft_mutex);
+  }
+  return true;
+}
+
+void Display::addOverlayRects(std::vector<DisplayRect> &rects)
+{
+  for (const auto &patch : overlay)
+  {
+    rects.push_back({.x = patch.x, .y = patch.y,
+                     .width = patch.sprite->width(),
+                     .height = patch.sprite->height()});
+  }
+}
+
+// Commit the overlay, adding where the old OSD was and where the new one is
+// to dirty if it changed
+bool Display::commitOverlay(std::vector<DisplayRect> &dirty)
+{
+  xSemaphoreTakeRecursive(overlay_mutex, portMAX_DELAY);
+  size_t count = dirty.size();
+  addOverlayRects(dirty);
+  bool changed = commitOverlay();
+  if (changed)
+  {
+    addOverlayRects(dirty);
+  }
+  else
+  {
+    dirty.resize(count);
+  }
+  xSemaphoreGiveRecursive(overlay_mutex);
+  return changed;
+}
+
+// Draw the overlay straight onto the panel, over whatever is there
+void Display::drawOverlay()
+{
+  xSemaphoreTakeRecursive(tft_mutex, portMAX_DELAY);
+  xSemaphoreTakeRecursive(overlay_mutex, portMAX_DELAY);
+  for (const auto &patch : overlay)
+  {
+    patch.sprite->pushSprite(patch.x, patch.y);
+  }
+  xSemaphoreGiveRecursive(overlay_mutex);
+  xSemaphoreGiveRecursive(tft_mutex);
+}
+
 // new function to push the framebuffer to the screen
 void Display::flushSprite()
 {
+  if (stripeMode)
+  {
+    // the frame is already on the panel, only the OSD is left to show
+    commitOverlay();
+    drawOverlay();
+    return;
+  }
+  // don't let a queued frame overwrite this one
+  waitForFlush();
+  commitOverlay();
+  xSemaphoreTakeRecursive(sprite_mutex, portMAX_DELAY);
   xSemaphoreTakeRecursive(tft_mutex, portMAX_DELAY);
-  frameSprite->pushSprite(0, 0);
+  pushFrame(frameSprite, NULL);
+  panelSprite = frameSprite;
   xSemaphoreGiveRecursive(tft_mutex);
+  xSemaphoreGiveRecursive(sprite_mutex);
+}
+
+void Display::presentSprite(const std::vector<DisplayRect> *dirty)
+{
+  if (stripeMode || frameSprites[1] == NULL)
+  {
+    flushSprite();
+    return;
+  }
+  if (flushTaskHandle == NULL)
+  {
+    xTaskCreatePinnedToCore(_flushTask, "DisplayFlush", 4096, this, 1,
+                            &flushTaskHandle, FLUSH_TASK_CORE);
+  }
+  // the other sprite is still being sent until the previous flush is done
+  xSemaphoreTake(flushIdle, portMAX_DELAY);
+  if (panelSprite != frameSprites[1 - frameSpriteIndex])
+  {
+    // something else reached the panel since the frame was diffed
+    dirty = NULL;
+  }
+  // the flush task only reads the rects of the sprite it is sending, and
+  // that is the other one until this sprite is queued
+  fullFrame[frameSpriteIndex] = dirty == NULL;
+  std::vector<DisplayRect> &rects = dirtyRects[frameSpriteIndex];
+  rects.clear();
+  if (dirty)
+  {
+    rects = *dirty;
+    commitOverlay(rects);
+  }
+  else
+  {
+    commitOverlay();
+  }
+  xSemaphoreTakeRecursive(sprite_mutex, portMAX_DELAY);
+  xQueueSend(flushQueue, &frameSprite, portMAX_DELAY);
+  panelSprite = frameSprite;
+  frameSpriteIndex = 1 - frameSpriteIndex;
+  frameSprite = frameSprites[frameSpriteIndex];
+  xSemaphoreGiveRecursive(sprite_mutex);
+}
+
+uint16_t *Display::getReferenceFramebuffer()
+{
+  if (stripeMode || frameSprites[1] == NULL)
+  {
+    return NULL;
+  }
+  TFT_eSprite *front = frameSprites[1 - frameSpriteIndex];
+  return panelSprite == front ? (uint16_t *)front->getPointer() : NULL;
+}
+
+void Display::waitForFlush()
+{
+  if (xSemaphoreTake(flushIdle, portMAX_DELAY) == pdTRUE)
+  {
+    xSemaphoreGive(flushIdle);
+  }
 }
 
 void Display::fillSprite(uint16_t color)
 {
-  xSemaphoreTakeRecursive(tft_mutex, portMAX_DELAY);
+  if (stripeMode)
+  {
+    fillScreen(color);
+    return;
+  }
+  xSemaphoreTakeRecursive(sprite_mutex, portMAX_DELAY);
   frameSprite->fillSprite(color);
-  xSemaphoreGiveRecursive(tft_mutex);
+  xSemaphoreGiveRecursive(sprite_mutex);
 }
 
 int Display::width()
@@ -99,24 +573,20 @@ int Display::height()
 
 void Display::fillScreen(uint16_t color)
 {
-  frameSprite->fillSprite(color);
-}
-
-void Display::drawOSD(const char *text, OSDPosition position, OSDLevel level)
-{
-  if (_prefs->getOsdLevel() < level)
+  if (stripeMode)
   {
+    xSemaphoreTakeRecursive(tft_mutex, portMAX_DELAY);
+    tft->fillScreen(color);
+    panelSprite = NULL;
+    xSemaphoreGiveRecursive(tft_mutex);
     return;
   }
-  xSemaphoreTakeRecursive(tft_mutex, portMAX_DELAY);
-  // draw OSD text into the sprite, with a black background for readability
-  frameSprite->setTextColor(TFT_ORANGE, TFT_BLACK);
-
-  int textWidth = frameSprite->textWidth(text);
-  int textHeight = frameSprite->fontHeight();
-  int x = 0;
-  int y = 0;
+  frameSprite->fillSprite(color);
+}
 
+void Display::getOSDOrigin(OSDPosition position, int textWidth,
+                           int textHeight, int &x, int &y)
+{
   switch (position)
   {
   case TOP_LEFT:
@@ -140,9 +610,26 @@ void Display::drawOSD(const char *text, OSDPosition position, OSDLevel level)
     y = (height() - textHeight) / 2;
     break;
   }
-  frameSprite->setCursor(x, y);
-  frameSprite->println(text);
-  xSemaphoreGiveRecursive(tft_mutex);
+}
+
+void Display::drawOSD(const char *text, OSDPosition position, OSDLevel level)
+{
+  if (_prefs->getOsdLevel() < level)
+  {
+    return;
+  }
+  xSemaphoreTakeRecursive(overlay_mutex, portMAX_DELAY);
+  // the same text may be drawn more than once before a flush
+  bool pending = false;
+  for (const auto &osd : pendingOsd)
+  {
+    pending = pending || (osd.text == text && osd.position == position);
+  }
+  if (!pending)
+  {
+    pendingOsd.push_back({text, position});
+  }
+  xSemaphoreGiveRecursive(overlay_mutex);
 }
 
 
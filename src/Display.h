@@ -5,29 +5,153 @@
 #include "Prefs.h"
 #include "OSD.h"
 #include "freertos/semphr.h"
+#include <string>
+#include <vector>
 
 class Prefs;
 
+typedef struct
+{
+  std::string text;
+  OSDPosition position;
+} OSDText;
+
+// OSD text pre-rendered for compositing over the frame
+typedef struct
+{
+  int x;
+  int y;
+  TFT_eSprite *sprite;
+} OverlayPatch;
+
+typedef struct
+{
+  int x;
+  int y;
+  int width;
+  int height;
+} DisplayRect;
+
+typedef struct
+{
+  uint32_t flushes;
+  // time taken to push a whole frame to the panel
+  uint32_t lastFlushUs;
+  uint32_t averageFlushUs;
+  uint32_t maxFlushUs;
+  // pixels sent for the last frame, less than a whole screen when only the
+  // parts that changed were sent
+  uint32_t lastPixelsPushed;
+  uint32_t averagePixelsPushed;
+} FlushStats;
+
 class Display
 {
 private:
   TFT_eSPI *tft;
+  // the sprite being drawn into, one of frameSprites
   TFT_eSprite *frameSprite;
+  // the sprite last pushed to the panel, the clean frame under the OSD
+  TFT_eSprite *displayedSprite = NULL;
+  TFT_eSprite *frameSprites[2] = {NULL, NULL};
+  int frameSpriteIndex = 0;
+  // the sprite the panel shows once queued flushes are done, NULL after
+  // anything else has been drawn straight to the panel
+  TFT_eSprite *panelSprite = NULL;
+  // the parts of each frame sprite to send when it is presented, all of it
+  // if fullFrame is set
+  std::vector<DisplayRect> dirtyRects[2];
+  bool fullFrame[2] = {true, true};
   Prefs *_prefs;
+  // internal memory stripes the DMA engine sends from, one is filled while
+  // the other is on the wire
   uint16_t *dmaBuffer[2] = {NULL, NULL};
   int dmaBufferIndex = 0;
+  int dmaBufferPixels = 0;
+  bool dmaEnabled = false;
+  // frames are decoded straight into dmaBuffer stripes, there's no sprite
+  bool stripeMode = false;
+  // top of the stripe being assembled, -1 if there isn't one
+  int stripeY = -1;
+  int stripeLines = 0;
+  // set while a frame's stripes are being sent
+  bool stripeWriting = false;
+  // OSD drawn since the last flush, and the overlay built from it. The
+  // overlay is composited over the frame as it is sent so the frame itself
+  // stays clean.
+  std::vector<OSDText> pendingOsd;
+  std::vector<OSDText> overlayOsd;
+  std::vector<OverlayPatch> overlay;
+  FlushStats flushStats = {};
+  // guards the panel
   SemaphoreHandle_t tft_mutex;
+  // guards drawing into frameSprite
+  SemaphoreHandle_t sprite_mutex;
+  // guards the OSD, always taken last
+  SemaphoreHandle_t overlay_mutex;
+  // sprites waiting to be pushed by the flush task
+  QueueHandle_t flushQueue;
+  // available while no flush is in flight
+  SemaphoreHandle_t flushIdle;
+  TaskHandle_t flushTaskHandle = NULL;
+
+  TFT_eSprite *createFrameSprite();
+  void pushFrame(TFT_eSprite *sprite, const std::vector<DisplayRect> *regions);
+  int pushRegion(TFT_eSprite *sprite, DisplayRect region);
+  void addOverlayRects(std::vector<DisplayRect> &rects);
+  bool commitOverlay(std::vector<DisplayRect> &dirty);
+  void pushStripe(uint16_t *pixels, int numPixels);
+  void compositeOverlay(uint16_t *pixels, DisplayRect region);
+  void getOSDOrigin(OSDPosition position, int textWidth, int textHeight,
+                    int &x, int &y);
+  void drawPixelsToStripe(int x, int y, int width, int height,
+                          uint16_t *pixels);
+  void sendStripe();
+  void drawOverlay();
+  static void _flushTask(void *param);
+  void flushTask();
 
 public:
   Display(Prefs *prefs);
   void setBrightness(uint8_t brightness);
   void drawPixels(int x, int y, int width, int height, uint16_t *pixels);
   void drawPixelsToSprite(int x, int y, int width, int height, uint16_t *pixels);
+  // The pixels of the sprite being drawn into, NULL in stripe mode
+  uint16_t *getFramebuffer()
+  {
+    return stripeMode ? NULL : (uint16_t *)frameSprite->getPointer();
+  }
+  // The pixels of the frame the panel shows, or will once queued flushes
+  // are done, to diff the next frame against. NULL if there isn't one that
+  // can be trusted to match the panel.
+  uint16_t *getReferenceFramebuffer();
+  // Push the sprite to the screen, waiting for any presented frames first
   void flushSprite();
+  // Queue the sprite to be pushed by the flush task and carry on drawing the
+  // next frame into the other buffer. The new back buffer still holds an
+  // older frame so the caller must repaint all of it. If dirty is given only
+  // those parts of the sprite are sent, plus wherever the OSD changed.
+  void presentSprite(const std::vector<DisplayRect> *dirty = NULL);
+  // Wait until presented frames are on the screen
+  void waitForFlush();
+  FlushStats getFlushStats() { return flushStats; }
+  // true if frames are streamed to the panel in stripes instead of being
+  // drawn into a sprite, in that mode there's no frame to redraw the OSD over
+  bool usesStripes() { return stripeMode; }
+  // Send the last partial stripe of a frame
+  void flushStripes();
+  // Make the OSD drawn since the last flush the overlay composited over
+  // frames, returns true if it changed
+  bool commitOverlay();
+  // Show the OSD drawn since the last flush over the frame on screen, only
+  // sending the areas it changed. Returns false if there's no frame to draw
+  // it over.
+  bool updateOverlay();
   void fillSprite(uint16_t color);
   int width();
   int height();
   void fillScreen(uint16_t color);
+  // Add text to the OSD shown with the next flush
   void drawOSD(const char *text, OSDPosition position, OSDLevel level);
   void drawSDCardFailed();
   static uint16_t color565(uint8_t r, uint8_t g, uint8_t b)
@@ -0,0 +1,186 @@
+#include "FlashLibrary.h"
+
+// the partition default_16MB.csv reserves for a file system we don't use
+const char *MEDIA_PARTITION_LABEL = "spiffs";
+const char MEDIA_IMAGE_MAGIC[4] = {'T', 'T', 'M', 'I'};
+const size_t FLASH_SECTOR_SIZE = 4096;
+
+bool FlashLibrary::begin()
+{
+  mPartition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                        ESP_PARTITION_SUBTYPE_ANY,
+                                        MEDIA_PARTITION_LABEL);
+  if (!mPartition)
+  {
+    Serial.println("No media partition");
+    return false;
+  }
+  MediaImageHeader header;
+  if (esp_partition_read(mPartition, 0, &header, sizeof(header)) != ESP_OK ||
+      memcmp(header.magic, MEDIA_IMAGE_MAGIC, 4) != 0)
+  {
+    Serial.println("No media image in flash");
+    return false;
+  }
+  // 64 bit so a huge entry count can't wrap round to a small size
+  uint64_t entriesEnd = sizeof(MediaImageHeader) +
+                        (uint64_t)header.entryCount * sizeof(MediaImageEntry);
+  if (header.version != MEDIA_IMAGE_VERSION ||
+      header.length > mPartition->size || entriesEnd > header.length)
+  {
+    Serial.printf("Unsupported media image, version %u, %u bytes\n",
+                  header.version, header.length);
+    return false;
+  }
+  const void *image;
+  if (esp_partition_mmap(mPartition, 0, header.length, SPI_FLASH_MMAP_DATA,
+                         &image, &mMapHandle) != ESP_OK)
+  {
+    Serial.printf("Failed to map %u bytes of media\n", header.length);
+    return false;
+  }
+  mImage = (const uint8_t *)image;
+  mImageLength = header.length;
+  mEntries = (const MediaImageEntry *)(mImage + sizeof(MediaImageHeader));
+  mEntryCount = header.entryCount;
+  Serial.printf("Mapped %d media entries, %u bytes\n", mEntryCount,
+                mImageLength);
+  return true;
+}
+
+std::vector<int> FlashLibrary::findEntries(MediaType type)
+{
+  std::vector<int> entries;
+  for (int i = 0; i < mEntryCount; i++)
+  {
+    if (mEntries[i].type == type && mEntries[i].frameCount > 0)
+    {
+      entries.push_back(i);
+    }
+  }
+  return entries;
+}
+
+const MediaImageEntry *FlashLibrary::getEntry(int index)
+{
+  if (index < 0 || index >= mEntryCount)
+  {
+    return NULL;
+  }
+  return &mEntries[index];
+}
+
+size_t FlashLibrary::getFrame(int entry, int frame, const uint8_t **data)
+{
+  const MediaImageEntry *mediaEntry = getEntry(entry);
+  if (mWriting || !mediaEntry || frame < 0 ||
+      (uint32_t)frame >= mediaEntry->frameCount)
+  {
+    return 0;
+  }
+  // the image is only checked as far as it's used, so check every offset
+  // against the mapping rather than trusting it
+  uint64_t tableEntry = (uint64_t)mediaEntry->framesOffset +
+                        (uint64_t)frame * sizeof(MediaImageFrame);
+  if (tableEntry + sizeof(MediaImageFrame) > mImageLength)
+  {
+    return 0;
+  }
+  MediaImageFrame location;
+  memcpy(&location, mImage + tableEntry, sizeof(location));
+  if ((uint64_t)location.offset + location.length > mImageLength)
+  {
+    return 0;
+  }
+  *data = mImage + location.offset;
+  return location.length;
+}
+
+bool FlashLibrary::beginWrite()
+{
+  mWriteFailed = !mPartition;
+  mErasedTo = 0;
+  memset(mMagic, 0, sizeof(mMagic));
+  // the players stop getting frames from the old image from now on
+  mWriting = true;
+  mUploading = true;
+  return !mWriteFailed;
+}
+
+bool FlashLibrary::write(size_t offset, const uint8_t *data, size_t length)
+{
+  if (mWriteFailed || offset + length > mPartition->size)
+  {
+    mWriteFailed = true;
+    return false;
+  }
+  // erase just ahead of the data rather than the whole partition up front,
+  // which would take long enough for the upload to time out
+  size_t end = offset + length;
+  if (end > mErasedTo)
+  {
+    size_t eraseEnd = (end + FLASH_SECTOR_SIZE - 1) / FLASH_SECTOR_SIZE *
+                      FLASH_SECTOR_SIZE;
+    eraseEnd = min(eraseEnd, (size_t)mPartition->size);
+    if (esp_partition_erase_range(mPartition, mErasedTo,
+                                  eraseEnd - mErasedTo) != ESP_OK)
+    {
+      Serial.printf("Failed to erase media at %zu\n", mErasedTo);
+      mWriteFailed = true;
+      return false;
+    }
+    mErasedTo = eraseEnd;
+  }
+  // hold the magic back until the whole image is in
+  while (offset < sizeof(mMagic) && length > 0)
+  {
+    mMagic[offset++] = *data++;
+    length--;
+  }
+  if (length > 0 &&
+      esp_partition_write(mPartition, offset, data, length) != ESP_OK)
+  {
+    Serial.printf("Failed to write media at %zu\n", offset);
+    mWriteFailed = true;
+  }
+  return !mWriteFailed;
+}
+
+bool FlashLibrary::endWrite(size_t length)
+{
+  mUploading = false;
+  MediaImageHeader header;
+  if (!mWriteFailed &&
+      esp_partition_read(mPartition, 0, &header, sizeof(header)) == ESP_OK)
+  {
+    memcpy(header.magic, mMagic, sizeof(mMagic));
+    mWriteFailed = length < sizeof(header) ||
+                   memcmp(header.magic, MEDIA_IMAGE_MAGIC, 4) != 0 ||
+                   header.version != MEDIA_IMAGE_VERSION ||
+                   header.length != length;
+    if (mWriteFailed)
+    {
+      Serial.println("Uploaded file isn't a media image");
+    }
+  }
+  if (!mWriteFailed &&
+      esp_partition_write(mPartition, 0, mMagic, sizeof(mMagic)) != ESP_OK)
+  {
+    mWriteFailed = true;
+  }
+  Serial.printf("Media upload %s, %zu bytes\n", mWriteFailed ? "failed" : "done",
+                length);
+  return !mWriteFailed;
+}
+
+bool FlashLibrary::abortWrite()
+{
+  if (!mUploading)
+  {
+    return false;
+  }
+  mUploading = false;
+  mWriteFailed = true;
+  Serial.println("Media upload aborted");
+  return true;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_partition.h>
+#include <string>
+#include <vector>
+
+// Layout of the media image pack_media.py builds. Everything is little
+// endian and offsets are from the start of the partition.
+const uint32_t MEDIA_IMAGE_VERSION = 1;
+
+enum class MediaType : uint32_t
+{
+  VIDEO = 0,
+  IMAGE = 1
+};
+
+typedef struct
+{
+  // "TTMI", written last so a partial upload is never mistaken for an image
+  char magic[4];
+  uint32_t version;
+  // bytes used in the partition, including this header
+  uint32_t length;
+  uint32_t entryCount;
+} MediaImageHeader;
+
+// One video or image, the entries follow the header
+typedef struct
+{
+  char name[32];
+  MediaType type;
+  // stream time base, a frame lasts scale / rate seconds
+  uint32_t rate;
+  uint32_t scale;
+  uint32_t frameCount;
+  // where the MediaImageFrame table of this entry starts
+  uint32_t framesOffset;
+} MediaImageEntry;
+
+typedef struct
+{
+  uint32_t offset;
+  uint32_t length;
+} MediaImageFrame;
+
+// Videos and images packed into the data partition the firmware otherwise
+// leaves empty. The image is memory mapped, so frames go to the decoder
+// straight from flash without being read or copied.
+class FlashLibrary
+{
+private:
+  const esp_partition_t *mPartition = NULL;
+  spi_flash_mmap_handle_t mMapHandle;
+  // the mapped image, NULL if there isn't a valid one
+  const uint8_t *mImage = NULL;
+  uint32_t mImageLength = 0;
+  const MediaImageEntry *mEntries = NULL;
+  int mEntryCount = 0;
+
+  // upload state
+  volatile bool mWriting = false;
+  // between beginWrite and endWrite
+  bool mUploading = false;
+  bool mWriteFailed = false;
+  // flash before this offset has been erased for the upload
+  size_t mErasedTo = 0;
+  char mMagic[4];
+
+public:
+  // Find the partition and map the image in it, false if there's none
+  bool begin();
+  bool isMounted() { return mImage != NULL; }
+  // true from the start of an upload, the mapped image may be erased or
+  // half written so nothing in it can be trusted
+  bool isWriting() { return mWriting; }
+  // Indexes of the entries of the given type, in the order they were packed
+  std::vector<int> findEntries(MediaType type);
+  const MediaImageEntry *getEntry(int index);
+  // Point data at a frame in the mapped image and return its length. 0 if
+  // the frame doesn't exist or an upload is overwriting the image.
+  size_t getFrame(int entry, int frame, const uint8_t **data);
+
+  // Replace the image with one uploaded in order, in pieces. The new image
+  // is used after a restart.
+  bool beginWrite();
+  bool write(size_t offset, const uint8_t *data, size_t length);
+  bool endWrite(size_t length);
+  // Give up on an upload that didn't get to endWrite, true if there was one.
+  // The old image is gone by then, so the caller should restart.
+  bool abortWrite();
+};
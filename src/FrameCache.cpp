@@ -0,0 +1,66 @@
+#include "FrameCache.h"
+
+int FrameCache::getCapacity(int pixelCount)
+{
+  return pixelCount > 0 ? mBudget / (pixelCount * 2) : 0;
+}
+
+CachedFrame *FrameCache::find(uint32_t crc, size_t length, int pixelCount)
+{
+  if (pixelCount != mPixelCount)
+  {
+    return NULL;
+  }
+  for (auto it = mFrames.begin(); it != mFrames.end(); ++it)
+  {
+    if (it->crc == crc && it->length == length)
+    {
+      mFrames.splice(mFrames.begin(), mFrames, it);
+      return &mFrames.front();
+    }
+  }
+  return NULL;
+}
+
+bool FrameCache::store(uint32_t crc, size_t length, int drawWidth,
+                       int drawHeight, const uint16_t *pixels, int pixelCount)
+{
+  if (pixelCount != mPixelCount)
+  {
+    // the screen changed size, none of the frames fit it any more
+    clear();
+    mPixelCount = pixelCount;
+  }
+  if (getCapacity(pixelCount) == 0)
+  {
+    return false;
+  }
+  uint16_t *buffer = NULL;
+  if ((int)mFrames.size() >= getCapacity(pixelCount))
+  {
+    // reuse the least recently used frame's pixels
+    buffer = mFrames.back().pixels;
+    mFrames.pop_back();
+  }
+  else
+  {
+    buffer = (uint16_t *)ps_malloc(pixelCount * 2);
+    if (!buffer)
+    {
+      return false;
+    }
+  }
+  memcpy(buffer, pixels, pixelCount * 2);
+  mFrames.push_front({.crc = crc, .length = length, .drawWidth = drawWidth,
+                      .drawHeight = drawHeight, .pixels = buffer});
+  return true;
+}
+
+void FrameCache::clear()
+{
+  for (auto &frame : mFrames)
+  {
+    free(frame.pixels);
+  }
+  mFrames.clear();
+}
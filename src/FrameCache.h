@@ -0,0 +1,42 @@
+#pragma once
+
+#include <Arduino.h>
+#include <list>
+
+// A frame decoded into a whole screen of RGB565 pixels
+typedef struct
+{
+  // CRC and length of the JPEG data the pixels were decoded from
+  uint32_t crc;
+  size_t length;
+  // size of the image within the screen, it's centered horizontally
+  int drawWidth;
+  int drawHeight;
+  uint16_t *pixels;
+} CachedFrame;
+
+// Decoded frames kept in PSRAM so short loops are only decoded once. Frames
+// are found by the CRC of their compressed data, so a file that changes
+// can't hit the pixels of what it used to hold. The least recently used
+// frame makes way when the budget is spent.
+class FrameCache
+{
+private:
+  size_t mBudget;
+  int mPixelCount = 0;
+  // most recently used first
+  std::list<CachedFrame> mFrames;
+
+public:
+  FrameCache(size_t budget) : mBudget(budget) {}
+  ~FrameCache() { clear(); }
+  bool isEnabled() { return mBudget > 0; }
+  // How many screens fit in the budget
+  int getCapacity(int pixelCount);
+  // The frame decoded from this data, NULL if it isn't cached
+  CachedFrame *find(uint32_t crc, size_t length, int pixelCount);
+  // Keep a copy of a decoded screen, false if there's no room for it
+  bool store(uint32_t crc, size_t length, int drawWidth, int drawHeight,
+             const uint16_t *pixels, int pixelCount);
+  void clear();
+};
@@ -0,0 +1,170 @@
+#include "FramePool.h"
+#include <esp_heap_caps.h>
+
+FrameHandle::FrameHandle(const FrameHandle &other) : mFrame(other.mFrame)
+{
+  if (mFrame)
+  {
+    mFrame->pool->retain(mFrame);
+  }
+}
+
+FrameHandle &FrameHandle::operator=(const FrameHandle &other)
+{
+  if (other.mFrame != mFrame)
+  {
+    if (other.mFrame)
+    {
+      other.mFrame->pool->retain(other.mFrame);
+    }
+    reset();
+    mFrame = other.mFrame;
+  }
+  return *this;
+}
+
+FrameHandle &FrameHandle::operator=(FrameHandle &&other)
+{
+  if (&other != this)
+  {
+    reset();
+    mFrame = other.mFrame;
+    other.mFrame = NULL;
+  }
+  return *this;
+}
+
+void FrameHandle::reset()
+{
+  if (mFrame)
+  {
+    mFrame->pool->release(mFrame);
+    mFrame = NULL;
+  }
+}
+
+Frame *FrameHandle::detach()
+{
+  Frame *frame = mFrame;
+  mFrame = NULL;
+  return frame;
+}
+
+FramePool::FramePool(int slotCount) : mSlotCount(slotCount)
+{
+  mSlots = (Frame *)calloc(slotCount, sizeof(Frame));
+  mFreeSlots = xQueueCreate(slotCount, sizeof(Frame *));
+  for (int i = 0; i < slotCount; i++)
+  {
+    Frame *frame = &mSlots[i];
+    frame->pool = this;
+    xQueueSend(mFreeSlots, &frame, 0);
+  }
+}
+
+FramePool::~FramePool()
+{
+  for (int i = 0; i < mSlotCount; i++)
+  {
+    if (mSlots[i].capacity > 0)
+    {
+      free(mSlots[i].data);
+    }
+  }
+  free(mSlots);
+  vQueueDelete(mFreeSlots);
+}
+
+FrameHandle FramePool::acquire(size_t capacity, TickType_t timeout)
+{
+  Frame *frame;
+  if (xQueueReceive(mFreeSlots, &frame, timeout) != pdTRUE)
+  {
+    return FrameHandle();
+  }
+  frame->refCount = 1;
+  frame->length = 0;
+  FrameHandle handle(frame);
+  if (frame->capacity == 0)
+  {
+    // drop anything the slot was borrowing
+    frame->data = NULL;
+  }
+  if (capacity > frame->capacity)
+  {
+    uint8_t *data =
+        (uint8_t *)heap_caps_realloc(frame->data, capacity, MALLOC_CAP_SPIRAM);
+    if (!data)
+    {
+      data = (uint8_t *)realloc(frame->data, capacity);
+    }
+    if (!data)
+    {
+      Serial.printf("Failed to grow frame slot to %zu bytes\n", capacity);
+      return FrameHandle();
+    }
+    frame->data = data;
+    frame->capacity = capacity;
+  }
+  return handle;
+}
+
+FrameHandle FramePool::wrap(const uint8_t *data, size_t length,
+                            TickType_t timeout)
+{
+  Frame *frame;
+  if (xQueueReceive(mFreeSlots, &frame, timeout) != pdTRUE)
+  {
+    return FrameHandle();
+  }
+  frame->refCount = 1;
+  FrameHandle handle(frame);
+  borrow(handle, data, length);
+  return handle;
+}
+
+void FramePool::borrow(FrameHandle &handle, const uint8_t *data,
+                       size_t length)
+{
+  Frame *frame = handle.get();
+  if (frame->capacity > 0)
+  {
+    free(frame->data);
+    frame->capacity = 0;
+  }
+  // decoders only read frames, they just aren't declared const
+  frame->data = (uint8_t *)data;
+  frame->length = length;
+}
+
+bool FramePool::isBorrowing(const uint8_t *data, size_t length)
+{
+  bool borrowing = false;
+  portENTER_CRITICAL(&mLock);
+  for (int i = 0; i < mSlotCount && !borrowing; i++)
+  {
+    Frame *frame = &mSlots[i];
+    borrowing = frame->refCount > 0 && frame->capacity == 0 &&
+                frame->data >= data && frame->data < data + length;
+  }
+  portEXIT_CRITICAL(&mLock);
+  return borrowing;
+}
+
+void FramePool::retain(Frame *frame)
+{
+  portENTER_CRITICAL(&mLock);
+  frame->refCount++;
+  portEXIT_CRITICAL(&mLock);
+}
+
+void FramePool::release(Frame *frame)
+{
+  portENTER_CRITICAL(&mLock);
+  int refCount = --frame->refCount;
+  portEXIT_CRITICAL(&mLock);
+  if (refCount == 0)
+  {
+    xQueueSend(mFreeSlots, &frame, 0);
+  }
+}
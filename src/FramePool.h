@@ -0,0 +1,101 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+class FramePool;
+
+// A compressed frame held in a pool slot
+typedef struct
+{
+  uint8_t *data;
+  // bytes the slot owns at data, 0 if it points at memory it borrowed
+  size_t capacity;
+  size_t length;
+  int refCount;
+  FramePool *pool;
+} Frame;
+
+// Shares a reference to a pooled frame. The slot goes back to its pool when
+// the last handle lets go, so frames move from source to decoder and stay
+// around for redraws without being copied.
+class FrameHandle
+{
+private:
+  Frame *mFrame = NULL;
+
+public:
+  FrameHandle() {}
+  // Take over a reference the caller already holds, e.g. one that was passed
+  // through a queue with detach()
+  explicit FrameHandle(Frame *frame) : mFrame(frame) {}
+  FrameHandle(const FrameHandle &other);
+  FrameHandle(FrameHandle &&other) : mFrame(other.mFrame) { other.mFrame = NULL; }
+  FrameHandle &operator=(const FrameHandle &other);
+  FrameHandle &operator=(FrameHandle &&other);
+  ~FrameHandle() { reset(); }
+
+  void reset();
+  // Give up the reference without releasing it
+  Frame *detach();
+  Frame *get() { return mFrame; }
+  explicit operator bool() const { return mFrame != NULL; }
+  uint8_t *data() { return mFrame ? mFrame->data : NULL; }
+  size_t length() { return mFrame ? mFrame->length : 0; }
+};
+
+// Hands frames from one task to another without either of them waiting on a
+// lock. Only the newest frame is kept, one that is replaced before it has
+// been taken is dropped.
+class FrameSlot
+{
+private:
+  std::atomic<Frame *> mFrame;
+
+public:
+  FrameSlot() : mFrame(NULL) {}
+  ~FrameSlot() { clear(); }
+  // Returns false if an older frame that hadn't been taken was dropped
+  bool publish(FrameHandle frame)
+  {
+    FrameHandle dropped(mFrame.exchange(frame.detach()));
+    return !dropped;
+  }
+  // Empty if nothing has been published since the last take
+  FrameHandle take() { return FrameHandle(mFrame.exchange(NULL)); }
+  void clear() { take(); }
+};
+
+// A fixed number of frame slots in PSRAM. Slot buffers grow to fit the
+// largest frame they have held and are reused from then on.
+class FramePool
+{
+private:
+  Frame *mSlots;
+  int mSlotCount;
+  // slots with no references left
+  QueueHandle_t mFreeSlots;
+  portMUX_TYPE mLock = portMUX_INITIALIZER_UNLOCKED;
+
+  friend class FrameHandle;
+  void retain(Frame *frame);
+  void release(Frame *frame);
+
+public:
+  FramePool(int slotCount);
+  ~FramePool();
+  // Wait for a free slot with room for at least capacity bytes, the handle is
+  // empty if none became free in time or the slot couldn't be grown
+  FrameHandle acquire(size_t capacity, TickType_t timeout);
+  // Wait for a free slot and point it at data the pool doesn't own, e.g.
+  // memory mapped flash, instead of copying it. The data has to outlive the
+  // handle.
+  FrameHandle wrap(const uint8_t *data, size_t length, TickType_t timeout);
+  // Point a slot acquired from this pool at data it doesn't own, as wrap does
+  void borrow(FrameHandle &frame, const uint8_t *data, size_t length);
+  // True while a handle still points into the length bytes at data, through
+  // a slot that borrowed them
+  bool isBorrowing(const uint8_t *data, size_t length);
+  int getSlotCount() { return mSlotCount; }
+  int getFreeSlotCount() { return uxQueueMessagesWaiting(mFreeSlots); }
+};
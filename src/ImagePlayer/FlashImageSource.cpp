@@ -0,0 +1,81 @@
+#include "FlashImageSource.h"
+#include "../FlashLibrary.h"
+#include <Arduino.h>
+
+FlashImageSource::FlashImageSource(FlashLibrary *library)
+    : mLibrary(library), mFramePool(2) {}
+
+bool FlashImageSource::fetchImageData()
+{
+  if (!mLibrary->isMounted())
+  {
+    return false;
+  }
+  mImages = mLibrary->findEntries(MediaType::IMAGE);
+  mImageNames.clear();
+  for (int entry : mImages)
+  {
+    const MediaImageEntry *image = mLibrary->getEntry(entry);
+    mImageNames.push_back(
+        std::string(image->name, strnlen(image->name, sizeof(image->name))));
+  }
+  if (mImages.empty())
+  {
+    Serial.println("No images in flash");
+    return false;
+  }
+  mImageNumber = 0;
+  mForceNext = true;
+  return true;
+}
+
+void FlashImageSource::setImage(int index)
+{
+  if (mImages.empty())
+  {
+    return;
+  }
+  mImageNumber = constrain(index, 0, (int)mImages.size() - 1);
+  mForceNext = true;
+}
+
+void FlashImageSource::nextImage()
+{
+  if (mImages.empty())
+  {
+    return;
+  }
+  int index = mImageNumber + 1;
+  if (index >= (int)mImages.size())
+  {
+    mWrapped = true;
+    index = 0;
+  }
+  setImage(index);
+}
+
+std::string FlashImageSource::getImageName()
+{
+  if (mImageNumber < 0 || mImageNumber >= (int)mImages.size())
+  {
+    return "Unknown";
+  }
+  return mImageNames[mImageNumber];
+}
+
+FrameHandle FlashImageSource::getImageFrame()
+{
+  // only emit a frame when the image changes, as SDCardImageSource does
+  if (mImages.empty() || !mForceNext || mLibrary->isWriting())
+  {
+    return FrameHandle();
+  }
+  mForceNext = false;
+  const uint8_t *data;
+  size_t length = mLibrary->getFrame(mImages[mImageNumber], 0, &data);
+  if (length == 0)
+  {
+    return FrameHandle();
+  }
+  return mFramePool.wrap(data, length, 0);
+}
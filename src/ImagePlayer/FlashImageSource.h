@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "ImageSource.h"
+
+class FlashLibrary;
+
+class FlashImageSource : public ImageSource
+{
+private:
+  FlashLibrary *mLibrary;
+  // library entries that are images, and their names, copied so nothing
+  // depends on the mapped image while an upload overwrites it
+  std::vector<int> mImages;
+  std::vector<std::string> mImageNames;
+  int mImageNumber = 0;
+  bool mForceNext = true;
+  volatile bool mWrapped = false;
+  // frames only borrow the mapped flash, the slots are for reference counts
+  FramePool mFramePool;
+
+public:
+  FlashImageSource(FlashLibrary *library);
+  bool fetchImageData() override;
+  int getImageCount() override { return mImages.size(); }
+  int getImageNumber() override { return mImageNumber; }
+  std::string getImageName() override;
+  void setImage(int index) override;
+  void nextImage() override;
+  FrameHandle getImageFrame() override;
+  uint32_t getAutoAdvanceIntervalMs() override { return 5000; }
+  bool showImageNameOSD() override { return false; }
+  bool consumeWrapped() override
+  {
+    bool wrapped = mWrapped;
+    mWrapped = false;
+    return wrapped;
+  }
+};
@@ -25,11 +25,6 @@ static void fadeBacklight(Display &display, int fromBrightness,
 static const int kFadeSteps = 50;
 static const int kFadeDelayMs = 20;
 
-void ImagePlayer::start()
-{
-  // no-op
-}
-
 ImagePlayer::ImagePlayer(ImageSource *imageSource, Display &display,
                          Prefs &prefs, Battery &battery)
     : MediaPlayer(display, prefs, battery),
@@ -38,21 +33,17 @@ ImagePlayer::ImagePlayer(ImageSource *imageSource, Display &display,
   mLastAdvanceMs = millis();
 }
 
-void ImagePlayer::set(int index)
+void ImagePlayer::onSet(int index)
 {
   if (!mImageSource)
   {
     return;
   }
-  if (xSemaphoreTake(mMutex, portMAX_DELAY) == pdTRUE)
-  {
-    mImageSource->setImage(index);
-    mLastAdvanceMs = millis();
-    xSemaphoreGive(mMutex);
-  }
+  mImageSource->setImage(index);
+  mLastAdvanceMs = millis();
 }
 
-void ImagePlayer::next()
+void ImagePlayer::onNext()
 {
   if (!mImageSource)
   {
@@ -62,21 +53,17 @@ void ImagePlayer::next()
   int targetBrightness = mPrefs.getBrightness();
   fadeBacklight(mDisplay, targetBrightness, 0, kFadeSteps, kFadeDelayMs);
 
-  if (xSemaphoreTake(mMutex, portMAX_DELAY) == pdTRUE)
-  {
-    mImageSource->nextImage();
-    mLastAdvanceMs = millis();
-    xSemaphoreGive(mMutex);
-  }
+  mImageSource->nextImage();
+  mLastAdvanceMs = millis();
 }
 
-bool ImagePlayer::getFrame(uint8_t **buffer, size_t &bufferLength, size_t &frameLength)
+FrameHandle ImagePlayer::getFrame()
 {
   if (!mImageSource)
   {
-    return false;
+    return FrameHandle();
   }
-  return mImageSource->getImageFrame(buffer, bufferLength, frameLength);
+  return mImageSource->getImageFrame();
 }
 
 void ImagePlayer::onLoop()
@@ -11,15 +11,13 @@ private:
   int lastRenderedIndex = -1;
 
 protected:
-  virtual bool getFrame(uint8_t **buffer, size_t &bufferLength, size_t &frameLength) override;
+  virtual FrameHandle getFrame() override;
   virtual void onFrameDisplayed() override;
   virtual void onLoop() override;
+  virtual void onSet(int index) override;
+  virtual void onNext() override;
 
 public:
   ImagePlayer(ImageSource *imageSource, Display &display, Prefs &prefs,
               Battery &battery);
-
-  virtual void set(int index) override;
-  virtual void next() override;
-  virtual void start() override;
 };
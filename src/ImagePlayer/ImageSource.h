@@ -1,5 +1,6 @@
 #pragma once
 
+#include "../FramePool.h"
 #include <stddef.h>
 #include <stdint.h>
 #include <string>
@@ -14,8 +15,10 @@ public:
   virtual std::string getImageName() = 0;
   virtual void setImage(int index) = 0;
   virtual void nextImage() = 0;
-  virtual bool getImageFrame(uint8_t **buffer, size_t &bufferLength,
-                             size_t &frameLength) = 0;
+  // Returns an empty handle unless the image has changed
+  virtual FrameHandle getImageFrame() = 0;
   virtual uint32_t getAutoAdvanceIntervalMs() { return 0; }
   virtual bool showImageNameOSD() { return true; }
+  // True once after the slideshow wraps from the last image to the first
+  virtual bool consumeWrapped() { return false; }
 };
@@ -1,12 +1,13 @@
 #include "SDCardImageSource.h"
+#include "../MediaCatalog.h"
 #include "../SDCard.h"
 #include <Arduino.h>
-#include <algorithm>
 #include <stdio.h>
 
 SDCardImageSource::SDCardImageSource(SDCard *sdCard, const char *path,
                                      bool showFilename)
-    : mSDCard(sdCard), mPath(path), mShowFilename(showFilename) {}
+    : mSDCard(sdCard), mPath(path), mShowFilename(showFilename),
+      mFramePool(2) {}
 
 bool SDCardImageSource::fetchImageData()
 {
@@ -16,21 +17,8 @@ bool SDCardImageSource::fetchImageData()
     return false;
   }
 
-  mImageFiles.clear();
-
-  auto jpg = mSDCard->listFiles(mPath, ".jpg");
-  auto jpeg = mSDCard->listFiles(mPath, ".jpeg");
-  auto JPG = mSDCard->listFiles(mPath, ".JPG");
-  auto JPEG = mSDCard->listFiles(mPath, ".JPEG");
-
-  mImageFiles.insert(mImageFiles.end(), jpg.begin(), jpg.end());
-  mImageFiles.insert(mImageFiles.end(), jpeg.begin(), jpeg.end());
-  mImageFiles.insert(mImageFiles.end(), JPG.begin(), JPG.end());
-  mImageFiles.insert(mImageFiles.end(), JPEG.begin(), JPEG.end());
-
-  std::sort(mImageFiles.begin(), mImageFiles.end());
-  mImageFiles.erase(std::unique(mImageFiles.begin(), mImageFiles.end()),
-                    mImageFiles.end());
+  mCatalog = mSDCard->getCatalog();
+  mImageFiles = mCatalog->find(MediaFileType::IMAGE, mPath);
 
   if (mImageFiles.empty())
   {
@@ -86,31 +74,26 @@ std::string SDCardImageSource::getImageName()
 {
   if (mImageNumber >= 0 && mImageNumber < (int)mImageFiles.size())
   {
-    std::string fullPath = mImageFiles[mImageNumber];
-    size_t lastSlash = fullPath.find_last_of('/');
-    if (lastSlash != std::string::npos)
-    {
-      return fullPath.substr(lastSlash + 1);
-    }
-    return fullPath;
+    return mCatalog->getName(mImageFiles[mImageNumber]);
   }
   return "Unknown";
 }
 
-bool SDCardImageSource::loadCurrentImage(uint8_t **buffer, size_t &bufferLength,
-                                         size_t &frameLength)
+FrameHandle SDCardImageSource::loadCurrentImage()
 {
   if (mImageNumber < 0 || mImageNumber >= (int)mImageFiles.size())
   {
-    return false;
+    return FrameHandle();
   }
 
-  const std::string &filename = mImageFiles[mImageNumber];
+  std::string filename = mCatalog->getPath(mImageFiles[mImageNumber]);
   FILE *f = fopen(filename.c_str(), "rb");
   if (!f)
   {
     Serial.printf("Failed to open image file %s\n", filename.c_str());
-    return false;
+    // the card may have changed in a way the catalog couldn't tell
+    mCatalog->invalidate();
+    return FrameHandle();
   }
 
   fseek(f, 0, SEEK_END);
@@ -118,44 +101,45 @@ bool SDCardImageSource::loadCurrentImage(uint8_t **buffer, size_t &bufferLength,
   if (size <= 0)
   {
     fclose(f);
-    return false;
+    return FrameHandle();
   }
   rewind(f);
 
-  if ((size_t)size > bufferLength)
+  FrameHandle frame = mFramePool.acquire((size_t)size, 0);
+  if (!frame)
   {
-    *buffer = (uint8_t *)realloc(*buffer, (size_t)size);
-    bufferLength = (size_t)size;
+    Serial.printf("No frame slot for %s\n", filename.c_str());
+    fclose(f);
+    return FrameHandle();
   }
 
-  size_t readCount = fread(*buffer, 1, (size_t)size, f);
+  size_t readCount = fread(frame.data(), 1, (size_t)size, f);
   fclose(f);
 
   if (readCount != (size_t)size)
   {
     Serial.printf("Short read for %s\n", filename.c_str());
-    return false;
+    return FrameHandle();
   }
 
-  frameLength = (size_t)size;
-  return true;
+  frame.get()->length = (size_t)size;
+  return frame;
 }
 
-bool SDCardImageSource::getImageFrame(uint8_t **buffer, size_t &bufferLength,
-                                      size_t &frameLength)
+FrameHandle SDCardImageSource::getImageFrame()
 {
   if (mImageFiles.empty())
   {
-    return false;
+    return FrameHandle();
   }
 
   // For still images, only emit a frame when forced by a channel change.
   // VideoPlayer owns the slideshow timer to avoid conflicts with manual next.
   if (!mForceNext)
   {
-    return false;
+    return FrameHandle();
   }
 
   mForceNext = false;
-  return loadCurrentImage(buffer, bufferLength, frameLength);
+  return loadCurrentImage();
 }
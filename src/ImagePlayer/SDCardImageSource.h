@@ -6,12 +6,15 @@
 #include "ImageSource.h"
 
 class SDCard;
+class MediaCatalog;
 
 class SDCardImageSource : public ImageSource
 {
 private:
-  std::vector<std::string> mImageFiles;
+  // catalog indexes of the images
+  std::vector<int> mImageFiles;
   SDCard *mSDCard;
+  MediaCatalog *mCatalog = NULL;
   const char *mPath;
   bool mShowFilename;
   int mImageNumber = 0;
@@ -19,9 +22,10 @@ private:
   unsigned long mIntervalMs = 5000;
   bool mForceNext = true;
   volatile bool mWrapped = false;
+  // the image on screen and the one being loaded
+  FramePool mFramePool;
 
-  bool loadCurrentImage(uint8_t **buffer, size_t &bufferLength,
-                        size_t &frameLength);
+  FrameHandle loadCurrentImage();
 
 public:
   SDCardImageSource(SDCard *sdCard, const char *path, bool showFilename = true);
@@ -31,11 +35,10 @@ public:
   std::string getImageName() override;
   void setImage(int index) override;
   void nextImage() override;
-  bool getImageFrame(uint8_t **buffer, size_t &bufferLength,
-                     size_t &frameLength) override;
+  FrameHandle getImageFrame() override;
   uint32_t getAutoAdvanceIntervalMs() override { return (uint32_t)mIntervalMs; }
   bool showImageNameOSD() override { return mShowFilename; }
-  bool consumeWrapped()
+  bool consumeWrapped() override
   {
     bool wrapped = mWrapped;
     mWrapped = false;
@@ -0,0 +1,356 @@
+#include "MediaCatalog.h"
+#include "SDCard.h"
+#include <algorithm>
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define CATALOG_CACHE_MAGIC "TTC1"
+// hidden, so it isn't listed itself
+const char *CATALOG_CACHE_NAME = ".catalog.ttc";
+// deeper folders are ignored rather than risking a runaway walk
+const int CATALOG_MAX_DEPTH = 8;
+
+typedef struct
+{
+  char magic[4];
+  uint32_t directoryCount;
+  uint32_t entryCount;
+  uint32_t namesLength;
+  uint64_t freeBytes;
+} CatalogCacheHeader;
+
+static bool hasExtension(const char *name, size_t length, const char *extension)
+{
+  size_t extensionLength = strlen(extension);
+  return length > extensionLength &&
+         strcasecmp(name + length - extensionLength, extension) == 0;
+}
+
+MediaCatalog::MediaCatalog(SDCard *sdCard)
+    : mSDCard(sdCard), mRoot(sdCard->getMountPoint())
+{
+}
+
+MediaCatalog::~MediaCatalog()
+{
+  free(mNames);
+}
+
+uint32_t MediaCatalog::addName(const char *name, size_t length)
+{
+  if (mNamesLength + length + 1 > mNamesCapacity)
+  {
+    size_t capacity = max(mNamesCapacity * 2, mNamesLength + length + 1024);
+    char *names = (char *)ps_realloc(mNames, capacity);
+    if (!names)
+    {
+      return UINT32_MAX;
+    }
+    mNames = names;
+    mNamesCapacity = capacity;
+  }
+  uint32_t offset = mNamesLength;
+  memcpy(mNames + offset, name, length);
+  mNames[offset + length] = 0;
+  mNamesLength += length + 1;
+  return offset;
+}
+
+uint32_t MediaCatalog::getDirectoryTime(const char *name)
+{
+  // FAT can't stat its root, which counts as never changing
+  struct stat info;
+  std::string path = name[0] ? mRoot + "/" + name : mRoot;
+  if (stat(path.c_str(), &info) != 0)
+  {
+    return 0;
+  }
+  return info.st_mtime;
+}
+
+void MediaCatalog::walk()
+{
+  mNamesLength = 0;
+  mEntries.clear();
+  mDirectories.clear();
+  std::vector<int> depths;
+  mDirectories.push_back({.name = addName("", 0), .mtime = 0});
+  depths.push_back(0);
+  bool outOfMemory = mDirectories[0].name == UINT32_MAX;
+  // the folder list grows as the walk finds more
+  for (size_t i = 0; i < mDirectories.size() && !outOfMemory; i++)
+  {
+    std::string folder = mNames + mDirectories[i].name;
+    mDirectories[i].mtime = getDirectoryTime(folder.c_str());
+    std::string path = folder.empty() ? mRoot : mRoot + "/" + folder;
+    DIR *dir = opendir(path.c_str());
+    if (!dir)
+    {
+      Serial.printf("Failed to open directory %s\n", path.c_str());
+      continue;
+    }
+    std::string prefix = folder.empty() ? "" : folder + "/";
+    struct dirent *ent;
+    while (!outOfMemory && (ent = readdir(dir)) != NULL)
+    {
+      const char *name = ent->d_name;
+      size_t length = strlen(name);
+      if (name[0] == '.' || strcmp(name, "System Volume Information") == 0)
+      {
+        continue;
+      }
+      bool isFolder = ent->d_type == DT_DIR;
+      MediaFileType type = MediaFileType::VIDEO;
+      if (isFolder)
+      {
+        if (depths[i] + 1 >= CATALOG_MAX_DEPTH)
+        {
+          continue;
+        }
+      }
+      else if (ent->d_type != DT_REG)
+      {
+        continue;
+      }
+      else if (hasExtension(name, length, ".avi"))
+      {
+        type = MediaFileType::VIDEO;
+      }
+      else if (hasExtension(name, length, ".jpg") ||
+               hasExtension(name, length, ".jpeg"))
+      {
+        type = MediaFileType::IMAGE;
+      }
+      else
+      {
+        continue;
+      }
+      std::string relative = prefix + name;
+      uint32_t offset = addName(relative.c_str(), relative.length());
+      outOfMemory = offset == UINT32_MAX;
+      if (outOfMemory)
+      {
+        break;
+      }
+      if (isFolder)
+      {
+        mDirectories.push_back({.name = offset, .mtime = 0});
+        depths.push_back(depths[i] + 1);
+      }
+      else
+      {
+        mEntries.push_back({.name = offset, .type = type});
+      }
+    }
+    closedir(dir);
+  }
+  if (outOfMemory)
+  {
+    Serial.println("Out of memory for the catalog");
+    mEntries.clear();
+    mDirectories.clear();
+    return;
+  }
+  const char *names = mNames;
+  std::sort(mEntries.begin(), mEntries.end(),
+            [names](const CatalogEntry &a, const CatalogEntry &b)
+            { return strcmp(names + a.name, names + b.name) < 0; });
+}
+
+std::string MediaCatalog::getCachePath()
+{
+  return mRoot + "/" + CATALOG_CACHE_NAME;
+}
+
+bool MediaCatalog::loadCache()
+{
+  FILE *f = fopen(getCachePath().c_str(), "rb");
+  if (!f)
+  {
+    return false;
+  }
+  fseek(f, 0, SEEK_END);
+  long fileLength = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  CatalogCacheHeader header;
+  bool valid = fread(&header, sizeof(header), 1, f) == 1 &&
+               strncmp(header.magic, CATALOG_CACHE_MAGIC, 4) == 0 &&
+               header.directoryCount > 0 &&
+               header.freeBytes == mSDCard->getFreeBytes();
+  // the counts must add up to the file exactly before anything is sized by
+  // them, so a damaged catalog can't ask for more than it holds
+  uint64_t expectedLength =
+      sizeof(header) +
+      (uint64_t)header.directoryCount * sizeof(CatalogDirectory) +
+      (uint64_t)header.entryCount * sizeof(CatalogEntry) + header.namesLength;
+  valid = valid && fileLength >= 0 && expectedLength == (uint64_t)fileLength;
+  free(mNames);
+  mNames = NULL;
+  mNamesLength = mNamesCapacity = 0;
+  if (valid)
+  {
+    mNames = (char *)ps_malloc((size_t)header.namesLength + 1);
+    valid = mNames != NULL;
+  }
+  if (valid)
+  {
+    mNamesLength = header.namesLength;
+    mNamesCapacity = mNamesLength + 1;
+    mDirectories.resize(header.directoryCount);
+    mEntries.resize(header.entryCount);
+    valid = fread(mDirectories.data(), sizeof(CatalogDirectory),
+                  header.directoryCount, f) == header.directoryCount &&
+            fread(mEntries.data(), sizeof(CatalogEntry), header.entryCount,
+                  f) == header.entryCount &&
+            fread(mNames, 1, header.namesLength, f) == header.namesLength;
+  }
+  fclose(f);
+  if (valid)
+  {
+    // anything outside the pool would be read from wherever it points
+    mNames[mNamesLength] = 0;
+    for (const auto &entry : mEntries)
+    {
+      valid = valid && entry.name < mNamesLength;
+    }
+    for (const auto &directory : mDirectories)
+    {
+      valid = valid && directory.name < mNamesLength &&
+              directory.mtime == getDirectoryTime(mNames + directory.name);
+    }
+  }
+  if (!valid)
+  {
+    // the walk starts again from an empty pool
+    free(mNames);
+    mNames = NULL;
+    mNamesLength = mNamesCapacity = 0;
+    mEntries.clear();
+    mDirectories.clear();
+    return false;
+  }
+  mFreeBytes = header.freeBytes;
+  return true;
+}
+
+bool MediaCatalog::writeCacheHeader(FILE *f)
+{
+  CatalogCacheHeader header;
+  memcpy(header.magic, CATALOG_CACHE_MAGIC, 4);
+  header.directoryCount = mDirectories.size();
+  header.entryCount = mEntries.size();
+  header.namesLength = mNamesLength;
+  header.freeBytes = mFreeBytes;
+  return fwrite(&header, sizeof(header), 1, f) == 1 &&
+         fwrite(mDirectories.data(), sizeof(CatalogDirectory),
+                mDirectories.size(), f) == mDirectories.size();
+}
+
+void MediaCatalog::saveCache()
+{
+  std::string path = getCachePath();
+  FILE *f = fopen(path.c_str(), "wb");
+  if (!f)
+  {
+    // e.g. the card is write protected, we'll just walk it again next time
+    Serial.printf("Can't write catalog %s\n", path.c_str());
+    return;
+  }
+  bool written =
+      writeCacheHeader(f) &&
+      fwrite(mEntries.data(), sizeof(CatalogEntry), mEntries.size(), f) ==
+          mEntries.size() &&
+      fwrite(mNames, 1, mNamesLength, f) == mNamesLength;
+  written = fclose(f) == 0 && written;
+  if (written)
+  {
+    // writing the cache changes the free space, and the root's time on
+    // file systems that keep one, so take both again and rewrite them in
+    // place where that won't change them any more
+    mFreeBytes = mSDCard->getFreeBytes();
+    for (auto &directory : mDirectories)
+    {
+      directory.mtime = getDirectoryTime(mNames + directory.name);
+    }
+    f = fopen(path.c_str(), "r+b");
+    written = f && writeCacheHeader(f);
+    written = f && fclose(f) == 0 && written;
+  }
+  if (!written)
+  {
+    // don't leave a truncated catalog behind
+    Serial.printf("Failed to write catalog %s\n", path.c_str());
+    remove(path.c_str());
+  }
+}
+
+void MediaCatalog::load()
+{
+  unsigned long start = millis();
+  if (loadCache())
+  {
+    Serial.printf("Loaded catalog of %d files in %lu ms\n",
+                  (int)mEntries.size(), millis() - start);
+    return;
+  }
+  walk();
+  Serial.printf("Found %d files in %d folders in %lu ms\n",
+                (int)mEntries.size(), (int)mDirectories.size(),
+                millis() - start);
+  if (!mDirectories.empty())
+  {
+    saveCache();
+  }
+}
+
+std::vector<int> MediaCatalog::find(MediaFileType type, const char *folder)
+{
+  // folders are given from the root, e.g. "/" or "/clips"
+  std::string prefix = folder;
+  while (!prefix.empty() && prefix.front() == '/')
+  {
+    prefix.erase(0, 1);
+  }
+  if (!prefix.empty() && prefix.back() != '/')
+  {
+    prefix += "/";
+  }
+  std::vector<int> files;
+  for (size_t i = 0; i < mEntries.size(); i++)
+  {
+    if (mEntries[i].type == type &&
+        strncmp(mNames + mEntries[i].name, prefix.c_str(), prefix.length()) ==
+            0)
+    {
+      files.push_back(i);
+    }
+  }
+  return files;
+}
+
+std::string MediaCatalog::getPath(int index)
+{
+  if (index < 0 || (size_t)index >= mEntries.size())
+  {
+    return "";
+  }
+  return mRoot + "/" + (mNames + mEntries[index].name);
+}
+
+const char *MediaCatalog::getName(int index)
+{
+  if (index < 0 || (size_t)index >= mEntries.size())
+  {
+    return "Unknown";
+  }
+  const char *path = mNames + mEntries[index].name;
+  const char *lastSlash = strrchr(path, '/');
+  return lastSlash ? lastSlash + 1 : path;
+}
+
+void MediaCatalog::invalidate()
+{
+  remove(getCachePath().c_str());
+}
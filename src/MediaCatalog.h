@@ -0,0 +1,71 @@
+#pragma once
+
+#include <Arduino.h>
+#include <string>
+#include <vector>
+
+class SDCard;
+
+enum class MediaFileType : uint32_t
+{
+  VIDEO = 0,
+  IMAGE = 1
+};
+
+typedef struct
+{
+  // offset of the path, relative to the card's root, in the name pool
+  uint32_t name;
+  MediaFileType type;
+} CatalogEntry;
+
+typedef struct
+{
+  uint32_t name;
+  // modification time when the catalog was written
+  uint32_t mtime;
+} CatalogDirectory;
+
+// Every video and image on the card, found in a single walk of all its
+// folders. Paths are kept in one PSRAM pool rather than as strings, and
+// the catalog is saved to the card so the next boot only has to check it's
+// still current instead of walking the card again.
+class MediaCatalog
+{
+private:
+  SDCard *mSDCard;
+  std::string mRoot;
+  // NUL terminated paths, relative to the root
+  char *mNames = NULL;
+  size_t mNamesLength = 0;
+  size_t mNamesCapacity = 0;
+  // sorted by path
+  std::vector<CatalogEntry> mEntries;
+  // every folder walked, the root first
+  std::vector<CatalogDirectory> mDirectories;
+  // the card's free space when the catalog was written
+  uint64_t mFreeBytes = 0;
+
+  uint32_t addName(const char *name, size_t length);
+  uint32_t getDirectoryTime(const char *name);
+  void walk();
+  bool loadCache();
+  void saveCache();
+  bool writeCacheHeader(FILE *f);
+  std::string getCachePath();
+
+public:
+  MediaCatalog(SDCard *sdCard);
+  ~MediaCatalog();
+  // Load the saved catalog, or walk the card if it's stale
+  void load();
+  // Indexes of the files of a type under a folder, in path order
+  std::vector<int> find(MediaFileType type, const char *folder);
+  // Full path of a file, e.g. /sdcard/clips/intro.avi
+  std::string getPath(int index);
+  // Name of a file without its folder
+  const char *getName(int index);
+  // Walk the card again on the next boot, e.g. when a file in the catalog
+  // can't be opened
+  void invalidate();
+};
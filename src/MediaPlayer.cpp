@@ -2,112 +2,268 @@
 #include "Display.h"
 #include "Prefs.h"
 #include "Battery.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include <esp_rom_crc.h>
+#include <esp_timer.h>
+
+// decode on core 1 while the display flush and SD reader run on core 0
+const int DECODE_TASK_CORE = 1;
+// commands waiting for the render worker
+const int PLAYER_COMMAND_QUEUE_DEPTH = 8;
+// bytes of each frame that go into its fingerprint
+const int FINGERPRINT_SAMPLES = 64;
+// rows of a cached frame compared with the panel at a time, an MCU row
+const int CACHED_DIFF_ROWS = 16;
+
+#ifndef FRAME_CACHE_BYTES
+// no PSRAM is set aside for decoded frames unless the build asks for it
+#define FRAME_CACHE_BYTES 0
+#endif
 
 int _doDraw(JPEGDRAW *pDraw)
 {
   MediaPlayer *player = (MediaPlayer *)pDraw->pUser;
-  // calculate the x offset to center the image
-  int x_offset = 0;
-  int imageWidth = player->mJpeg.getWidth();
-  int screenWidth = player->mDisplay.width();
-  x_offset = (screenWidth - imageWidth) / 2;
-  player->mDisplay.drawPixelsToSprite(pDraw->x + x_offset, pDraw->y,
-                                      pDraw->iWidth, pDraw->iHeight,
+  player->mDisplay.drawPixelsToSprite(pDraw->x + player->mDrawOffsetX,
+                                      pDraw->y, pDraw->iWidth, pDraw->iHeight,
                                       pDraw->pPixels);
   return 1;
 }
 
-void MediaPlayer::_task(void *param)
+// Copy decoded MCU blocks straight into the sprite's pixels. FullWidth is
+// the common case of the image being as wide as the screen, where blocks
+// need no centering and a full row of MCUs is a single copy.
+template <bool FullWidth>
+int _drawToFramebuffer(JPEGDRAW *pDraw)
 {
-  MediaPlayer *player = (MediaPlayer *)param;
-  player->task();
+  MediaPlayer *player = (MediaPlayer *)pDraw->pUser;
+  int pitch = player->mFramebufferWidth;
+  int rows = min(pDraw->iHeight, player->mFramebufferHeight - pDraw->y);
+  int x = FullWidth ? pDraw->x : pDraw->x + player->mDrawOffsetX;
+  uint16_t *dest = player->mFramebuffer + pDraw->y * pitch;
+  // blocks can hang over either edge, and the last one in a row may be
+  // padded out to a whole MCU
+  int left = max(x, 0);
+  int right = min(x + pDraw->iWidth, pitch);
+  if (player->mReferenceFramebuffer && left < right && rows > 0)
+  {
+    player->diffBlock(left, pDraw->y, right - left, rows,
+                      pDraw->pPixels + left - x, pDraw->iWidth);
+  }
+  if (FullWidth && x == 0 && pDraw->iWidth == pitch && rows > 0)
+  {
+    memcpy(dest, pDraw->pPixels, pitch * rows * 2);
+    return 1;
+  }
+  for (int row = 0; row < rows && left < right; row++)
+  {
+    memcpy(dest + row * pitch + left,
+           pDraw->pPixels + row * pDraw->iWidth + left - x,
+           (right - left) * 2);
+  }
+  return 1;
 }
 
-MediaPlayer::MediaPlayer(Display &display, Prefs &prefs, Battery &battery)
-    : mDisplay(display), mPrefs(prefs), mBattery(battery)
+// A cheap fingerprint of a compressed frame, a CRC of bytes sampled evenly
+// through it. Frames that differ almost always differ in their size or
+// somewhere in the entropy coded data these land on.
+static uint32_t frameFingerprint(FrameHandle &frame)
+{
+  uint8_t samples[FINGERPRINT_SAMPLES];
+  size_t length = frame.length();
+  const uint8_t *data = frame.data();
+  for (int i = 0; i < FINGERPRINT_SAMPLES; i++)
+  {
+    samples[i] = data[(uint64_t)length * i / FINGERPRINT_SAMPLES];
+  }
+  return esp_rom_crc32_le(length, samples, FINGERPRINT_SAMPLES);
+}
+
+// one render worker is shared by all the players, only one plays at a time
+static TaskHandle_t workerTaskHandle = NULL;
+static QueueHandle_t workerCommands = NULL;
+// the player the worker renders frames for, NULL while it's idle
+static MediaPlayer *activePlayer = NULL;
+// decoded frames, shared like the worker as only one player draws at a time
+static FrameCache frameCache(FRAME_CACHE_BYTES);
+
+void MediaPlayer::_workerTask(void *param)
 {
-  mMutex = xSemaphoreCreateMutex();
+  workerTask();
 }
 
-MediaPlayer::~MediaPlayer()
+void MediaPlayer::workerTask()
 {
-  if (mTaskHandle != NULL)
+  PlayerCommand command;
+  while (true)
   {
-    mRunTask = false;
-    while (mTaskHandle != NULL)
+    // act on whatever was asked for since the last frame, with nothing to
+    // play sleep until there's something to do
+    while (xQueueReceive(workerCommands, &command,
+                         activePlayer ? 0 : portMAX_DELAY) == pdTRUE)
     {
-      vTaskDelay(10);
+      command.player->handleCommand(command);
+      if (command.done)
+      {
+        xSemaphoreGive(command.done);
+      }
+    }
+    if (activePlayer)
+    {
+      activePlayer->renderFrame();
     }
   }
-  if (mCurrentFrame)
+}
+
+void MediaPlayer::startWorker()
+{
+  if (workerTaskHandle != NULL)
   {
-    free(mCurrentFrame);
+    return;
   }
-  vSemaphoreDelete(mMutex);
+  workerCommands = xQueueCreate(PLAYER_COMMAND_QUEUE_DEPTH,
+                                sizeof(PlayerCommand));
+  xTaskCreatePinnedToCore(_workerTask, "MediaPlayer", 10000, NULL, 1,
+                          &workerTaskHandle, DECODE_TASK_CORE);
 }
 
-void MediaPlayer::start()
+MediaPlayer::MediaPlayer(Display &display, Prefs &prefs, Battery &battery)
+    : mDisplay(display), mPrefs(prefs), mBattery(battery)
 {
-  // default implementation is to start the task
-  startTask();
+  mCommandDone = xSemaphoreCreateBinary();
 }
 
-void MediaPlayer::startTask()
+MediaPlayer::~MediaPlayer()
 {
-  mRunTask = true;
-  xTaskCreatePinnedToCore(_task, "MediaPlayer", 10000, this, 1,
-                          &mTaskHandle, 0);
+  stop();
+  vSemaphoreDelete(mCommandDone);
 }
 
-void MediaPlayer::play()
+void MediaPlayer::start()
 {
-  if (mState == MediaPlayerState::PLAYING)
+  startWorker();
+}
+
+void MediaPlayer::sendCommand(PlayerCommandType type, int index, bool wait)
+{
+  startWorker();
+  PlayerCommand command = {.player = this, .type = type, .index = index,
+                           .done = NULL};
+  if (xTaskGetCurrentTaskHandle() == workerTaskHandle)
   {
+    // asked from the worker itself, e.g. a slideshow advancing
+    handleCommand(command);
     return;
   }
-  auto oldState = mState;
-  mState = MediaPlayerState::PLAYING;
-  onStateChanged(oldState, mState);
-  if (mTaskHandle == NULL)
+  if (wait)
   {
-    startTask();
+    command.done = mCommandDone;
+  }
+  xQueueSend(workerCommands, &command, portMAX_DELAY);
+  // cut short whatever the worker is waiting for
+  xTaskNotifyGive(workerTaskHandle);
+  if (wait)
+  {
+    xSemaphoreTake(mCommandDone, portMAX_DELAY);
   }
 }
 
-void MediaPlayer::stop()
+bool MediaPlayer::hasPendingCommands()
 {
-  if (mState == MediaPlayerState::STOPPED)
-  {
-    return;
-  }
-  mRunTask = false;
-  while (mTaskHandle != NULL)
+  return uxQueueMessagesWaiting(workerCommands) > 0;
+}
+
+void MediaPlayer::handleCommand(const PlayerCommand &command)
+{
+  switch (command.type)
   {
-    vTaskDelay(10);
+  case PlayerCommandType::PLAY:
+    if (mState != MediaPlayerState::PLAYING)
+    {
+      changeState(MediaPlayerState::PLAYING);
+    }
+    activate();
+    break;
+  case PlayerCommandType::PAUSE:
+    if (mState != MediaPlayerState::PAUSED)
+    {
+      char batText[12];
+      sprintf(batText, mBattery.isCharging() ? "Chrg %d%%" : "Batt. %d%%",
+              mBattery.getBatteryLevel());
+      drawOSDTimed(std::string(batText), TOP_RIGHT, OSDLevel::STANDARD);
+      drawOSDTimed(std::string("Paused"), CENTER, OSDLevel::STANDARD);
+      changeState(MediaPlayerState::PAUSED);
+    }
+    break;
+  case PlayerCommandType::STOP:
+    if (mState != MediaPlayerState::STOPPED)
+    {
+      deactivate();
+      changeState(MediaPlayerState::STOPPED);
+      mDisplay.fillSprite(DisplayColors::BLACK);
+      mDisplay.drawOSD("Stopped", CENTER, OSDLevel::STANDARD);
+      mDisplay.flushSprite();
+    }
+    break;
+  case PlayerCommandType::SET:
+    mReceivedFrames = 0;
+    mDuplicateFrames = 0;
+    mFrameCacheMisses = 0;
+    onSet(command.index);
+    break;
+  case PlayerCommandType::NEXT:
+    mReceivedFrames = 0;
+    mDuplicateFrames = 0;
+    mFrameCacheMisses = 0;
+    onNext();
+    break;
+  case PlayerCommandType::STATIC:
+    if (mState != MediaPlayerState::STATIC)
+    {
+      changeState(MediaPlayerState::STATIC);
+      mDisplay.fillScreen(DisplayColors::BLACK);
+      activate();
+    }
+    break;
   }
+}
+
+void MediaPlayer::changeState(MediaPlayerState state)
+{
   auto oldState = mState;
-  mState = MediaPlayerState::STOPPED;
+  mState = state;
   onStateChanged(oldState, mState);
-  vTaskDelay(10);
-  mDisplay.fillSprite(DisplayColors::BLACK);
-  mDisplay.drawOSD("Stopped", CENTER, OSDLevel::STANDARD);
-  mDisplay.flushSprite();
 }
 
-void MediaPlayer::pause()
+void MediaPlayer::activate()
+{
+  activePlayer = this;
+}
+
+void MediaPlayer::deactivate()
 {
-  if (mState == MediaPlayerState::PAUSED)
+  if (activePlayer != this)
   {
     return;
   }
-  char batText[12];
-  sprintf(batText, mBattery.isCharging() ? "Chrg %d%%" : "Batt. %d%%",
-          mBattery.getBatteryLevel());
-  drawOSDTimed(std::string(batText), TOP_RIGHT, OSDLevel::STANDARD);
-  drawOSDTimed(std::string("Paused"), CENTER, OSDLevel::STANDARD);
-  auto oldState = mState;
-  mState = MediaPlayerState::PAUSED;
-  onStateChanged(oldState, mState);
+  mDisplay.waitForFlush();
+  mCurrentFrame.reset();
+  activePlayer = NULL;
+}
+
+void MediaPlayer::play()
+{
+  sendCommand(PlayerCommandType::PLAY);
+}
+
+void MediaPlayer::stop()
+{
+  sendCommand(PlayerCommandType::STOP, 0, true);
+}
+
+void MediaPlayer::pause()
+{
+  sendCommand(PlayerCommandType::PAUSE);
 }
 
 void MediaPlayer::playPauseToggle()
@@ -122,6 +278,16 @@ void MediaPlayer::playPauseToggle()
   }
 }
 
+void MediaPlayer::next()
+{
+  sendCommand(PlayerCommandType::NEXT);
+}
+
+void MediaPlayer::set(int index)
+{
+  sendCommand(PlayerCommandType::SET, index);
+}
+
 void MediaPlayer::drawOSDTimed(const std::string &text, OSDPosition position,
                                OSDLevel level, uint32_t durationMs)
 {
@@ -129,119 +295,366 @@ void MediaPlayer::drawOSDTimed(const std::string &text, OSDPosition position,
     return;
   mTimedOsds.push_back({text, position, level, millis() + durationMs});
   mDisplay.drawOSD(text.c_str(), position, level);
+  mOsdChanged = true;
 }
 
-void MediaPlayer::task()
+JPEG_DRAW_CALLBACK *MediaPlayer::getDrawCallback(int imageWidth)
 {
-  uint8_t *jpegBuffer = NULL;
-  size_t jpegBufferLength = 0;
-  size_t jpegLength = 0;
+  if (!mFramebuffer)
+  {
+    return _doDraw;
+  }
+  if (imageWidth == mFramebufferWidth)
+  {
+    return _drawToFramebuffer<true>;
+  }
+  return _drawToFramebuffer<false>;
+}
 
-  while (mRunTask)
+// Transcoded clips often hold runs of identical frames, from static intros
+// or frame rate conversion. Those don't need decoding or sending again.
+bool MediaPlayer::isDuplicateFrame(FrameHandle &frame, uint32_t fingerprint)
+{
+  if (!mCurrentFrame || fingerprint != mCurrentFingerprint ||
+      frame.length() != mCurrentFrame.length())
   {
-    bool needsRedraw = false;
-    for (auto it = mTimedOsds.begin(); it != mTimedOsds.end();)
-    {
-      if (millis() >= it->endTime)
-      {
-        it = mTimedOsds.erase(it);
-        needsRedraw = true;
-      }
-      else
-      {
-        ++it;
-      }
-    }
+    return false;
+  }
+  // a matching fingerprint is only a hint
+  return memcmp(frame.data(), mCurrentFrame.data(), frame.length()) == 0;
+}
 
-    if (mState == MediaPlayerState::STATIC)
+// Compare a decoded block with the same pixels of the frame on the panel
+// and mark the columns that changed in any of its rows as dirty
+void MediaPlayer::diffBlock(int x, int y, int width, int rows,
+                            const uint16_t *pixels, int stride)
+{
+  const uint16_t *reference = mReferenceFramebuffer + y * mFramebufferWidth + x;
+  int first = width;
+  int last = 0;
+  for (int row = 0; row < rows; row++)
+  {
+    const uint16_t *src = pixels + row * stride;
+    const uint16_t *ref = reference + row * mFramebufferWidth;
+    if (memcmp(src, ref, width * 2) == 0)
     {
-      onStatic();
-      vTaskDelay(20 / portTICK_PERIOD_MS);
       continue;
     }
-
-    bool gotFrame = false;
-    if (mState == MediaPlayerState::PLAYING)
+    int left = 0;
+    while (src[left] == ref[left])
     {
-      onLoop();
-      if (xSemaphoreTake(mMutex, portMAX_DELAY) == pdTRUE)
-      {
-        gotFrame = getFrame(&jpegBuffer, jpegBufferLength, jpegLength);
-        xSemaphoreGive(mMutex);
-      }
+      left++;
     }
+    int right = width;
+    while (src[right - 1] == ref[right - 1])
+    {
+      right--;
+    }
+    first = min(first, left);
+    last = max(last, right);
+  }
+  if (first < last)
+  {
+    markDirty(x + first, y, last - first, rows);
+  }
+}
 
-    // if we don't have a new frame, and we don't need to redraw for OSD, then we can just wait
-    if (!gotFrame && !needsRedraw)
+// Blocks arrive left to right a row of MCUs at a time, so the changes in a
+// row are gathered into one span
+void MediaPlayer::markDirty(int x, int y, int width, int height)
+{
+  if (!mDirtyRects.empty())
+  {
+    DisplayRect &last = mDirtyRects.back();
+    if (last.y == y && last.height == height)
     {
-      vTaskDelay(10 / portTICK_PERIOD_MS);
-      continue;
+      int right = max(last.x + last.width, x + width);
+      last.x = min(last.x, x);
+      last.width = right - last.x;
+      return;
     }
+  }
+  mDirtyRects.push_back({.x = x, .y = y, .width = width, .height = height});
+}
 
-    if (gotFrame)
+// Merge the spans of neighbouring MCU rows where they overlap, so each
+// changed area is sent through a single address window
+void MediaPlayer::coalesceDirtyRects()
+{
+  std::vector<DisplayRect> merged;
+  for (const auto &rect : mDirtyRects)
+  {
+    if (!merged.empty())
     {
-      if (mCurrentFrame == NULL || jpegLength > mCurrentFrameSize)
-      {
-        if (mCurrentFrame)
-        {
-          free(mCurrentFrame);
-        }
-        mCurrentFrame = (uint8_t *)malloc(jpegLength);
-      }
-      if (mCurrentFrame)
+      DisplayRect &last = merged.back();
+      int lastRight = last.x + last.width;
+      int right = rect.x + rect.width;
+      if (last.y + last.height == rect.y && rect.x < lastRight &&
+          last.x < right)
       {
-        mCurrentFrameSize = jpegLength;
-        memcpy(mCurrentFrame, jpegBuffer, jpegLength);
+        last.x = min(last.x, rect.x);
+        last.width = max(lastRight, right) - last.x;
+        last.height += rect.height;
+        continue;
       }
     }
+    merged.push_back(rect);
+  }
+  mDirtyRects.swap(merged);
+}
 
-    // if we got a frame, or we need to redraw for OSD, then draw
-    if (mCurrentFrame)
+// Put a frame decoded earlier into the sprite, marking what differs from the
+// frame on the panel just as decoding it would
+void MediaPlayer::drawCachedFrame(const CachedFrame *cached)
+{
+  if (cached->drawWidth != mDrawWidth || cached->drawHeight != mDrawHeight)
+  {
+    mDrawWidth = cached->drawWidth;
+    mDrawHeight = cached->drawHeight;
+    mReferenceFramebuffer = NULL;
+  }
+  mDrawOffsetX = (mFramebufferWidth - mDrawWidth) / 2;
+  if (mReferenceFramebuffer)
+  {
+    for (int y = 0; y < mFramebufferHeight; y += CACHED_DIFF_ROWS)
     {
-      mWaitForFirstFrame = false;
-      if (mJpeg.openRAM(mCurrentFrame, mCurrentFrameSize, _doDraw))
-      {
-        mJpeg.setUserPointer(this);
-        mJpeg.setPixelType(RGB565_BIG_ENDIAN);
-        mJpeg.decode(0, 0, 0);
-        mJpeg.close();
-      }
+      diffBlock(0, y, mFramebufferWidth,
+                min(CACHED_DIFF_ROWS, mFramebufferHeight - y),
+                cached->pixels + y * mFramebufferWidth, mFramebufferWidth);
+    }
+  }
+  memcpy(mFramebuffer, cached->pixels,
+         mFramebufferWidth * mFramebufferHeight * 2);
+}
+
+void MediaPlayer::decodeCurrentFrame()
+{
+  TRACE_SCOPE("decode");
+  int64_t start = esp_timer_get_time();
+  mFramebuffer = mDisplay.getFramebuffer();
+  mFramebufferWidth = mDisplay.width();
+  mFramebufferHeight = mDisplay.height();
+  mReferenceFramebuffer = mFramebuffer ? mDisplay.getReferenceFramebuffer()
+                                       : NULL;
+  mDirtyRects.clear();
+  // the cache holds whole sprites, there's nothing to keep in stripe mode
+  int pixelCount = mFramebufferWidth * mFramebufferHeight;
+  bool cacheable = mFramebuffer && frameCache.isEnabled();
+  uint32_t crc = 0;
+  CachedFrame *cached = NULL;
+  if (cacheable)
+  {
+    crc = esp_rom_crc32_le(0, mCurrentFrame.data(), mCurrentFrame.length());
+    cached = frameCache.find(crc, mCurrentFrame.length(), pixelCount);
+  }
+  if (cached)
+  {
+    drawCachedFrame(cached);
+    coalesceDirtyRects();
+    Metrics::record(Metric::DECODE_US, esp_timer_get_time() - start);
+    Metrics::count(Counter::FRAMES_CACHED);
+    return;
+  }
+  // the draw callback has to be given before the header is parsed, so guess
+  // that this frame is as wide as the last one
+  bool opened = mJpeg.openRAM(mCurrentFrame.data(), mCurrentFrame.length(),
+                              getDrawCallback(mDrawWidth));
+  if (opened && mJpeg.getWidth() != mDrawWidth)
+  {
+    mDrawWidth = mJpeg.getWidth();
+    mJpeg.close();
+    opened = mJpeg.openRAM(mCurrentFrame.data(), mCurrentFrame.length(),
+                           getDrawCallback(mDrawWidth));
+    // the letterbox moved, everything has to be sent
+    mReferenceFramebuffer = NULL;
+  }
+  if (opened && mJpeg.getHeight() != mDrawHeight)
+  {
+    mDrawHeight = mJpeg.getHeight();
+    mReferenceFramebuffer = NULL;
+  }
+  bool decoded = false;
+  if (opened)
+  {
+    mDrawOffsetX = (mFramebufferWidth - mDrawWidth) / 2;
+    mJpeg.setUserPointer(this);
+    mJpeg.setPixelType(RGB565_BIG_ENDIAN);
+    decoded = mJpeg.decode(0, 0, 0) != 0;
+    mJpeg.close();
+  }
+  if (!decoded)
+  {
+    // parts of the sprite may still hold an older frame
+    mReferenceFramebuffer = NULL;
+  }
+  // once a channel has missed more frames than the cache holds it isn't a
+  // loop that fits, so stop copying frames in only to push them out again
+  else if (cacheable &&
+           mFrameCacheMisses++ < frameCache.getCapacity(pixelCount))
+  {
+    frameCache.store(crc, mCurrentFrame.length(), mDrawWidth, mDrawHeight,
+                     mFramebuffer, pixelCount);
+  }
+  coalesceDirtyRects();
+  mDisplay.flushStripes();
+  // in stripe mode this includes sending the frame
+  Metrics::record(Metric::DECODE_US, esp_timer_get_time() - start);
+  Metrics::count(Counter::FRAMES_DECODED);
+}
+
+// Show one frame, or whatever the OSD needs, for the active player
+void MediaPlayer::renderFrame()
+{
+  TRACE_SCOPE("render");
+  bool needsRedraw = mOsdChanged;
+  mOsdChanged = false;
+  for (auto it = mTimedOsds.begin(); it != mTimedOsds.end();)
+  {
+    if (millis() >= it->endTime)
+    {
+      it = mTimedOsds.erase(it);
+      needsRedraw = true;
     }
     else
     {
-      // clear the screen if no frame
-      if (!mWaitForFirstFrame)
-      {
-        mDisplay.fillSprite(DisplayColors::BLACK);
-      }
+      ++it;
     }
+  }
 
-    onFrameDisplayed();
+  if (mState == MediaPlayerState::STATIC)
+  {
+    onStatic();
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(20));
+    return;
+  }
 
-    if (mBattery.isCharging())
+  FrameHandle frame;
+  if (mState == MediaPlayerState::PLAYING)
+  {
+    onLoop();
+    frame = getFrame();
+  }
+  bool gotFrame = (bool)frame;
+  bool duplicate = false;
+  if (gotFrame)
+  {
+    mReceivedFrames++;
+    uint32_t fingerprint = frameFingerprint(frame);
+    duplicate = isDuplicateFrame(frame, fingerprint);
+    if (duplicate)
     {
-      mDisplay.drawOSD("Charging", TOP_RIGHT, OSDLevel::DEBUG);
+      // the frame on screen is this one already
+      mDuplicateFrames++;
+      Metrics::count(Counter::FRAMES_SKIPPED);
+      frame.reset();
+      gotFrame = false;
     }
-    else if (mBattery.isLowBattery())
+    else
     {
-      mDisplay.drawOSD("Low Batt.", TOP_RIGHT, OSDLevel::STANDARD);
+      mCurrentFingerprint = fingerprint;
     }
+  }
+
+  // if we don't have a new frame, and we don't need to redraw for OSD, then we can just wait
+  if (!gotFrame && !needsRedraw && !duplicate)
+  {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(10));
+    return;
+  }
+
+  if (gotFrame)
+  {
+    // the previous frame goes back to its pool
+    mCurrentFrame = std::move(frame);
+  }
 
-    for (const auto &osd : mTimedOsds)
+  // if only the OSD changed, it can be redrawn over the frame on screen
+  // without decoding it again
+  bool overlayOnly = !gotFrame && mCurrentFrame &&
+                     (duplicate || !mDisplay.usesStripes());
+
+  // if we got a frame, or we need to redraw for OSD, then draw
+  bool repainted = true;
+  bool decoded = false;
+  if (overlayOnly)
+  {
+    repainted = false;
+  }
+  else if (mCurrentFrame)
+  {
+    mWaitForFirstFrame = false;
+    decodeCurrentFrame();
+    decoded = true;
+  }
+  else
+  {
+    // clear the screen if no frame
+    if (!mWaitForFirstFrame)
+    {
+      mDisplay.fillSprite(DisplayColors::BLACK);
+    }
+    else
     {
-      mDisplay.drawOSD(osd.text.c_str(), osd.position, osd.level);
+      repainted = false;
     }
+  }
 
-    mDisplay.flushSprite();
+  onFrameDisplayed();
+
+  if (mBattery.isCharging())
+  {
+    mDisplay.drawOSD("Charging", TOP_RIGHT, OSDLevel::DEBUG);
+  }
+  else if (mBattery.isLowBattery())
+  {
+    mDisplay.drawOSD("Low Batt.", TOP_RIGHT, OSDLevel::STANDARD);
   }
 
-  if (mCurrentFrame)
+  for (const auto &osd : mTimedOsds)
   {
-    free(mCurrentFrame);
-    mCurrentFrame = NULL;
-    mCurrentFrameSize = 0;
+    mDisplay.drawOSD(osd.text.c_str(), osd.position, osd.level);
   }
 
-  mTaskHandle = NULL;
-  vTaskDelete(NULL);
+  if (overlayOnly && mDisplay.usesStripes())
+  {
+    // the OSD is composited into the stripes, so the frame has to be sent
+    // again if it changed
+    if (mDisplay.commitOverlay())
+    {
+      decodeCurrentFrame();
+    }
+  }
+  else if (overlayOnly)
+  {
+    if (!mDisplay.updateOverlay())
+    {
+      decodeCurrentFrame();
+      mDisplay.presentSprite();
+    }
+  }
+  else if (mDisplay.usesStripes())
+  {
+    if (!decoded)
+    {
+      mDisplay.flushSprite();
+    }
+    else if (mDisplay.commitOverlay())
+    {
+      // the stripes went out with the OSD of the previous frame, send the
+      // frame again now that it has changed
+      decodeCurrentFrame();
+    }
+  }
+  else if (repainted)
+  {
+    // send this frame from the flush task while we decode the next one,
+    // only the parts that changed if it was diffed against the last one
+    mDisplay.presentSprite(decoded && mReferenceFramebuffer ? &mDirtyRects
+                                                            : NULL);
+  }
+  else
+  {
+    // the back buffer may hold an older frame, keep drawing on this one
+    mDisplay.flushSprite();
+  }
 }
@@ -4,10 +4,13 @@
 #include <Arduino.h>
 #include <list>
 #include <string>
+#include <vector>
 
+#include "Display.h"
+#include "FrameCache.h"
+#include "FramePool.h"
 #include "OSD.h"
 
-class Display;
 class Prefs;
 class Battery;
 
@@ -27,7 +30,32 @@ enum class MediaPlayerState
   STATIC
 };
 
+class MediaPlayer;
+
+enum class PlayerCommandType
+{
+  PLAY,
+  PAUSE,
+  STOP,
+  SET,
+  NEXT,
+  STATIC
+};
+
+// Something for the render worker to do between frames
+typedef struct
+{
+  MediaPlayer *player;
+  PlayerCommandType type;
+  // the channel or image for SET
+  int index;
+  // given once the command has been carried out, NULL if nobody is waiting
+  SemaphoreHandle_t done;
+} PlayerCommand;
+
 int _doDraw(JPEGDRAW *pDraw);
+template <bool FullWidth>
+int _drawToFramebuffer(JPEGDRAW *pDraw);
 
 class MediaPlayer
 {
@@ -39,41 +67,85 @@ protected:
 
   MediaPlayerState mState = MediaPlayerState::STOPPED;
 
-  TaskHandle_t mTaskHandle = NULL;
-  volatile bool mRunTask = false;
+  // lets a caller wait for its command to be carried out
+  SemaphoreHandle_t mCommandDone = NULL;
 
   std::list<TimedOsd> mTimedOsds;
 
-  uint8_t *mCurrentFrame = NULL;
-  size_t mCurrentFrameSize = 0;
-
-  SemaphoreHandle_t mMutex = NULL;
+  // the frame on screen, kept for redraws
+  FrameHandle mCurrentFrame;
+  uint32_t mCurrentFingerprint = 0;
+  // frames received since the channel was set, and how many of them were
+  // the same as the one on screen
+  uint32_t mReceivedFrames = 0;
+  uint32_t mDuplicateFrames = 0;
+  // frames decoded since the channel was set that weren't in the cache
+  int mFrameCacheMisses = 0;
 
   bool mWaitForFirstFrame = false;
 
-  static void _task(void *param);
-  void task();
-  void startTask();
-
-  virtual bool getFrame(uint8_t **buffer, size_t &bufferLength, size_t &frameLength) = 0;
+  // where decoded pixels go, worked out once per frame rather than per MCU
+  uint16_t *mFramebuffer = NULL;
+  int mFramebufferWidth = 0;
+  int mFramebufferHeight = 0;
+  // width of the last decoded image and the offset that centers it
+  int mDrawWidth = 0;
+  int mDrawHeight = 0;
+  int mDrawOffsetX = 0;
+  // the frame on the panel that decoded blocks are compared with, NULL if
+  // the whole frame has to be sent
+  uint16_t *mReferenceFramebuffer = NULL;
+  // the parts of the decoded frame that differ from the reference
+  std::vector<DisplayRect> mDirtyRects;
+  // set when a timed OSD is added so it is shown without waiting for a frame
+  volatile bool mOsdChanged = false;
+
+  static void _workerTask(void *param);
+  static void workerTask();
+  static void startWorker();
+  void sendCommand(PlayerCommandType type, int index = 0, bool wait = false);
+  void handleCommand(const PlayerCommand &command);
+  // true if the worker should finish what it's doing and read its commands
+  bool hasPendingCommands();
+  void changeState(MediaPlayerState state);
+  void activate();
+  void deactivate();
+  void renderFrame();
+  void decodeCurrentFrame();
+  void drawCachedFrame(const CachedFrame *cached);
+  bool isDuplicateFrame(FrameHandle &frame, uint32_t fingerprint);
+  JPEG_DRAW_CALLBACK *getDrawCallback(int imageWidth);
+  void diffBlock(int x, int y, int width, int rows, const uint16_t *pixels,
+                 int stride);
+  void markDirty(int x, int y, int width, int height);
+  void coalesceDirtyRects();
+
+  virtual FrameHandle getFrame() = 0;
   virtual void onFrameDisplayed() {};
   virtual void onStateChanged(MediaPlayerState oldState, MediaPlayerState newState) {};
   virtual void onLoop() {};
   virtual void onStatic() {};
+  // carried out on the worker for set() and next()
+  virtual void onSet(int index) {};
+  virtual void onNext() {};
 
   friend int _doDraw(JPEGDRAW *pDraw);
+  template <bool FullWidth>
+  friend int _drawToFramebuffer(JPEGDRAW *pDraw);
 
 public:
   MediaPlayer(Display &display, Prefs &prefs, Battery &battery);
   virtual ~MediaPlayer();
 
   virtual void start();
+  // these are queued for the render worker, which acts on them at the next
+  // frame boundary. stop() waits for it, the rest return straight away.
   void play();
   void stop();
   void pause();
   void playPauseToggle();
-  virtual void next() {}
-  virtual void set(int index) {}
+  void next();
+  void set(int index);
 
   void setWaitForFirstFrame(bool wait) { mWaitForFirstFrame = wait; }
 
@@ -0,0 +1,104 @@
+#include "Metrics.h"
+#include <algorithm>
+#include <atomic>
+#include <stdio.h>
+
+// samples kept for each metric, the percentiles cover this many frames
+const int METRIC_WINDOW = 64;
+
+typedef struct
+{
+  // total samples recorded, the next one goes in at this modulo the window
+  std::atomic<uint32_t> recorded;
+  volatile uint32_t samples[METRIC_WINDOW];
+} MetricRing;
+
+static MetricRing rings[(int)Metric::COUNT];
+static std::atomic<uint32_t> counters[(int)Counter::COUNT];
+
+static const char *METRIC_NAMES[] = {"readUs", "decodeUs", "flushUs",
+                                     "readAheadFill", "pixelsPushed",
+                                     "zapUs"};
+static const char *COUNTER_NAMES[] = {"bytesRead", "framesDecoded",
+                                      "framesDropped", "framesSkipped",
+                                      "framesLate", "framesResident",
+                                      "framesCached"};
+
+void Metrics::record(Metric metric, uint32_t value)
+{
+  MetricRing &ring = rings[(int)metric];
+  uint32_t index = ring.recorded.fetch_add(1, std::memory_order_relaxed);
+  ring.samples[index % METRIC_WINDOW] = value;
+}
+
+void Metrics::count(Counter counter, uint32_t amount)
+{
+  counters[(int)counter].fetch_add(amount, std::memory_order_relaxed);
+}
+
+uint32_t Metrics::getCount(Counter counter)
+{
+  return counters[(int)counter].load(std::memory_order_relaxed);
+}
+
+MetricSummary Metrics::summarize(Metric metric)
+{
+  MetricRing &ring = rings[(int)metric];
+  // a sample being written while we copy only shifts the window by one
+  uint32_t samples[METRIC_WINDOW];
+  int count = min(ring.recorded.load(), (uint32_t)METRIC_WINDOW);
+  for (int i = 0; i < count; i++)
+  {
+    samples[i] = ring.samples[i];
+  }
+  MetricSummary summary = {};
+  summary.samples = count;
+  if (count == 0)
+  {
+    return summary;
+  }
+  std::sort(samples, samples + count);
+  summary.p50 = samples[(count - 1) * 50 / 100];
+  summary.p90 = samples[(count - 1) * 90 / 100];
+  summary.p99 = samples[(count - 1) * 99 / 100];
+  summary.max = samples[count - 1];
+  return summary;
+}
+
+const char *Metrics::getName(Metric metric)
+{
+  return METRIC_NAMES[(int)metric];
+}
+
+const char *Metrics::getName(Counter counter)
+{
+  return COUNTER_NAMES[(int)counter];
+}
+
+bool Metrics::dump(const char *path)
+{
+  FILE *file = fopen(path, "w");
+  if (!file)
+  {
+    Serial.printf("Failed to open %s\n", path);
+    return false;
+  }
+  fprintf(file, "{\"uptimeMs\":%lu,\"stages\":{", millis());
+  for (int i = 0; i < (int)Metric::COUNT; i++)
+  {
+    MetricSummary summary = summarize((Metric)i);
+    fprintf(file,
+            "%s\"%s\":{\"p50\":%u,\"p90\":%u,\"p99\":%u,\"max\":%u,"
+            "\"samples\":%d}",
+            i > 0 ? "," : "", getName((Metric)i), summary.p50, summary.p90,
+            summary.p99, summary.max, summary.samples);
+  }
+  fprintf(file, "},\"counters\":{");
+  for (int i = 0; i < (int)Counter::COUNT; i++)
+  {
+    fprintf(file, "%s\"%s\":%u", i > 0 ? "," : "", getName((Counter)i),
+            getCount((Counter)i));
+  }
+  bool ok = fprintf(file, "}}\n") > 0;
+  return fclose(file) == 0 && ok;
+}
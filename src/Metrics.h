@@ -0,0 +1,63 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Values sampled once per frame, summarised as percentiles over the most
+// recent frames
+enum class Metric
+{
+  // time to read a chunk from the card, including any seek
+  READ_US,
+  DECODE_US,
+  // time to push a frame to the panel
+  FLUSH_US,
+  // chunks waiting in the read-ahead queue when a frame is taken
+  READ_AHEAD_FILL,
+  PIXELS_PUSHED,
+  // from a channel being set to its first frame being handed to the player,
+  // one sample per switch
+  ZAP_US,
+  COUNT
+};
+
+// Running totals since boot
+enum class Counter
+{
+  BYTES_READ,
+  FRAMES_DECODED,
+  // skipped by the clock to catch up
+  FRAMES_DROPPED,
+  // repeats of the frame on screen that weren't decoded
+  FRAMES_SKIPPED,
+  // handed to the decoder more than a tick after they were due
+  FRAMES_LATE,
+  // served from a clip kept in PSRAM instead of the card
+  FRAMES_RESIDENT,
+  // copied from the decoded frame cache instead of being decoded
+  FRAMES_CACHED,
+  COUNT
+};
+
+typedef struct
+{
+  uint32_t p50;
+  uint32_t p90;
+  uint32_t p99;
+  uint32_t max;
+  // how many samples the percentiles were taken from
+  int samples;
+} MetricSummary;
+
+// A fixed size registry any task can record into without taking a lock, so
+// the stages can be timed without disturbing them
+namespace Metrics
+{
+  void record(Metric metric, uint32_t value);
+  void count(Counter counter, uint32_t amount = 1);
+  uint32_t getCount(Counter counter);
+  MetricSummary summarize(Metric metric);
+  const char *getName(Metric metric);
+  const char *getName(Counter counter);
+  // Write everything to a file as the same JSON /metrics serves
+  bool dump(const char *path);
+}
@@ -1,4 +1,5 @@
 #include "Prefs.h"
+#include "Trace.h"
 
 const char *Prefs::PREF_NAMESPACE = "minitv";
 const char *Prefs::PREF_SSID = "ssid";
@@ -8,10 +9,18 @@ const char *Prefs::PREF_OSD_LEVEL = "osd_level";
 const char *Prefs::PREF_TIMER_MINUTES = "timer_minutes";
 const char *Prefs::PREF_SLIDESHOW_INTERVAL_SECONDS = "slideshow_sec";
 
+// how long a setting has to stay the same before it is saved
+const uint32_t COMMIT_DELAY_MS = 2000;
+const uint32_t DIRTY_BRIGHTNESS = 1 << 0;
+const uint32_t DIRTY_OSD_LEVEL = 1 << 1;
+const uint32_t DIRTY_TIMER_MINUTES = 1 << 2;
+const uint32_t DIRTY_SLIDESHOW_INTERVAL = 1 << 3;
+
 Prefs::Prefs() {}
 
 void Prefs::begin()
 {
+  TRACE_SCOPE("nvs load");
   if (!preferences.begin(PREF_NAMESPACE, false))
   {
     Serial.println("Failed to initialize preferences. Clearing and re-initializing.");
@@ -21,6 +30,46 @@ void Prefs::begin()
       Serial.println("Failed to initialize preferences even after clearing.");
     }
   }
+  brightness = readIntPreference(PREF_BRIGHTNESS, 255); // Default brightness to 255
+  osd_level = readIntPreference(PREF_OSD_LEVEL, 1); // Default to standard OSD level
+  timer_minutes = readIntPreference(PREF_TIMER_MINUTES, 0); // Default to 0 (disabled)
+  slideshow_interval_seconds = readIntPreference(PREF_SLIDESHOW_INTERVAL_SECONDS, 5); // Default to 5
+}
+
+void Prefs::update()
+{
+  if (dirty_keys != 0 && millis() - last_change_ms >= COMMIT_DELAY_MS)
+  {
+    commit();
+  }
+}
+
+void Prefs::commit()
+{
+  TRACE_SCOPE("nvs commit");
+  uint32_t dirty = dirty_keys.exchange(0);
+  if (dirty & DIRTY_BRIGHTNESS)
+  {
+    writeIntPreference(PREF_BRIGHTNESS, brightness);
+  }
+  if (dirty & DIRTY_OSD_LEVEL)
+  {
+    writeIntPreference(PREF_OSD_LEVEL, osd_level);
+  }
+  if (dirty & DIRTY_TIMER_MINUTES)
+  {
+    writeIntPreference(PREF_TIMER_MINUTES, timer_minutes);
+  }
+  if (dirty & DIRTY_SLIDESHOW_INTERVAL)
+  {
+    writeIntPreference(PREF_SLIDESHOW_INTERVAL_SECONDS, slideshow_interval_seconds);
+  }
+}
+
+void Prefs::markDirty(uint32_t key)
+{
+  last_change_ms = millis();
+  dirty_keys |= key;
 }
 
 String Prefs::getSsid()
@@ -45,12 +94,13 @@ void Prefs::setPass(const String &pass)
 
 int Prefs::getBrightness()
 {
-  return readIntPreference(PREF_BRIGHTNESS, 255); // Default brightness to 255
+  return brightness;
 }
 
 void Prefs::setBrightness(int brightness)
 {
-  writeIntPreference(PREF_BRIGHTNESS, brightness);
+  this->brightness = brightness;
+  markDirty(DIRTY_BRIGHTNESS);
   if (brightness_changed_callback)
   {
     brightness_changed_callback(brightness);
@@ -64,23 +114,25 @@ void Prefs::onBrightnessChanged(std::function<void(int)> callback)
 
 OSDLevel Prefs::getOsdLevel()
 {
-  return (OSDLevel)readIntPreference(PREF_OSD_LEVEL, 1); // Default to standard OSD level
+  return (OSDLevel)osd_level.load();
 }
 
 void Prefs::setOsdLevel(int level)
 {
-  writeIntPreference(PREF_OSD_LEVEL, (int)level);
+  osd_level = level;
+  markDirty(DIRTY_OSD_LEVEL);
 }
 
 int Prefs::getTimerMinutes()
 {
-  return readIntPreference(PREF_TIMER_MINUTES, 0); // Default to 0 (disabled)
+  return timer_minutes;
 }
 
 void Prefs::setTimerMinutes(int minutes)
 {
   int clamped_minutes = constrain(minutes, 0, 60);
-  writeIntPreference(PREF_TIMER_MINUTES, clamped_minutes);
+  timer_minutes = clamped_minutes;
+  markDirty(DIRTY_TIMER_MINUTES);
   if (timer_minutes_changed_callback)
   {
     timer_minutes_changed_callback(clamped_minutes);
@@ -94,13 +146,14 @@ void Prefs::onTimerMinutesChanged(std::function<void(int)> callback)
 
 int Prefs::getSlideshowInterval()
 {
-  return readIntPreference(PREF_SLIDESHOW_INTERVAL_SECONDS, 5); // Default to 5
+  return slideshow_interval_seconds;
 }
 
 void Prefs::setSlideshowInterval(int seconds)
 {
   int clamped_seconds = constrain(seconds, 1, 60);
-  writeIntPreference(PREF_SLIDESHOW_INTERVAL_SECONDS, clamped_seconds);
+  slideshow_interval_seconds = clamped_seconds;
+  markDirty(DIRTY_SLIDESHOW_INTERVAL);
   if (slideshow_interval_changed_callback)
   {
     slideshow_interval_changed_callback(clamped_seconds);
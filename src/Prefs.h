@@ -3,6 +3,7 @@
 #include <Arduino.h>
 #include <Preferences.h>
 #include "OSD.h"
+#include <atomic>
 #include <functional>
 
 class Prefs
@@ -10,6 +11,11 @@ class Prefs
 public:
   Prefs();
   void begin();
+  // Save settings that have been left alone for a while, call from the
+  // main loop
+  void update();
+  // Save any changed settings now, e.g. before a restart
+  void commit();
 
   String getSsid();
   void setSsid(const String &ssid);
@@ -35,6 +41,15 @@ public:
 
 private:
   Preferences preferences;
+  // the settings read on the hot path are kept in RAM and only written to
+  // NVS once they stop changing, e.g. while a slider is dragged
+  std::atomic<int> brightness{255};
+  std::atomic<int> osd_level{1};
+  std::atomic<int> timer_minutes{0};
+  std::atomic<int> slideshow_interval_seconds{5};
+  // the keys changed since the last commit
+  std::atomic<uint32_t> dirty_keys{0};
+  volatile uint32_t last_change_ms = 0;
   std::function<void(int)> brightness_changed_callback;
   std::function<void(int)> timer_minutes_changed_callback;
   std::function<void(int)> slideshow_interval_changed_callback;
@@ -51,4 +66,5 @@ private:
   void writeStringPreference(const char *key, const String &value);
   int readIntPreference(const char *key, int defaultValue);
   void writeIntPreference(const char *key, int value);
+  void markDirty(uint32_t key);
 };
\ No newline at end of file
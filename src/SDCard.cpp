@@ -11,6 +11,8 @@
 #include "driver/sdmmc_host.h"
 #include "driver/sdspi_host.h"
 #include "sdmmc_cmd.h"
+#include "diskio_sdmmc.h"
+#include "MediaCatalog.h"
 #include "SDCard.h"
 
 #define SPI_DMA_CHAN SPI_DMA_CH_AUTO
@@ -143,34 +145,30 @@ bool SDCard::isMounted()
   return false;
 }
 
-std::vector<std::string> SDCard::listFiles(const char *folder, const char *extension)
+std::string SDCard::getMountPoint()
 {
-  std::vector<std::string> files;
-  char full_path[100];
-  sprintf(full_path, "/sdcard%s", folder);
-  Serial.printf("Listing directory: %s\n", full_path);
+  return MOUNT_POINT;
+}
 
-  // open the directory
-  DIR *dir = opendir(full_path);
-  if (!dir)
+uint64_t SDCard::getFreeBytes()
+{
+  FATFS *fs;
+  DWORD freeClusters;
+  char drive[3] = {(char)('0' + ff_diskio_get_pdrv_card(m_card)), ':', 0};
+  if (f_getfree(drive, &freeClusters, &fs) != FR_OK)
   {
-    Serial.println("Failed to open directory");
-    return files;
+    return 0;
   }
-  // list all the files in the directory that end with the extension
-  struct dirent *ent;
-  while ((ent = readdir(dir)) != NULL)
+  // SD cards have 512 byte sectors
+  return (uint64_t)freeClusters * fs->csize * 512;
+}
+
+MediaCatalog *SDCard::getCatalog()
+{
+  if (!m_catalog)
   {
-    std::string filename = ent->d_name;
-    bool isFile = ent->d_type == DT_REG;
-    bool isVisible = filename[0] != '.';
-    bool isMatchingExtension = extension == NULL || filename.find(extension) == filename.length() - strlen(extension);
-    if (isFile && isVisible && isMatchingExtension)
-    {
-      files.push_back("/sdcard/" + filename);
-    }
+    m_catalog = new MediaCatalog(this);
+    m_catalog->load();
   }
-  // sort the files alphabetically
-  std::sort(files.begin(), files.end());
-  return files;
-}
\ No newline at end of file
+  return m_catalog;
+}
@@ -7,6 +7,8 @@
 #include <vector>
 #include <string>
 
+class MediaCatalog;
+
 class SDCard
 {
 private:
@@ -17,11 +19,17 @@ private:
   sdmmc_host_t m_host = SDSPI_HOST_DEFAULT();
 #endif
   bool sd_card_init_success = false;
+  MediaCatalog *m_catalog = NULL;
 
 public:
   SDCard(gpio_num_t miso, gpio_num_t mosi, gpio_num_t clk, gpio_num_t cs);
   SDCard(gpio_num_t clk, gpio_num_t cmd, gpio_num_t d0, gpio_num_t d1, gpio_num_t d2, gpio_num_t d3);
   ~SDCard();
   bool isMounted();
-  std::vector<std::string> listFiles(const char *folder, const char *extension = NULL);
+  // where the card's files are, e.g. /sdcard
+  std::string getMountPoint();
+  // free space on the card, 0 if it can't be read
+  uint64_t getFreeBytes();
+  // the videos and images on the card, loaded the first time it's asked for
+  MediaCatalog *getCatalog();
 };
\ No newline at end of file
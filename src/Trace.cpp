@@ -0,0 +1,214 @@
+#include "Trace.h"
+#include <atomic>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <inttypes.h>
+#include <stdio.h>
+
+// events kept, older ones are overwritten
+const int TRACE_EVENTS = 8192;
+// tasks that can be told apart in the trace
+const int TRACE_THREADS = 16;
+const int TRACE_CORES = 2;
+
+typedef struct
+{
+  int64_t timestampUs;
+  const char *name;
+  TaskHandle_t task;
+  uint8_t core;
+  char phase;
+} TraceEvent;
+
+typedef struct
+{
+  TaskHandle_t task;
+  char name[configMAX_TASK_NAME_LEN];
+} TraceThread;
+
+static TraceEvent *events = NULL;
+static std::atomic<uint32_t> recorded(0);
+static std::atomic<int> readers(0);
+static TraceThread threads[TRACE_THREADS];
+static std::atomic<int> threadCount(0);
+static portMUX_TYPE threadLock = portMUX_INITIALIZER_UNLOCKED;
+
+void Trace::begin()
+{
+#ifdef TRACE
+  if (events == NULL)
+  {
+    events = (TraceEvent *)heap_caps_calloc(TRACE_EVENTS, sizeof(TraceEvent),
+                                            MALLOC_CAP_SPIRAM);
+    if (events == NULL)
+    {
+      Serial.println("Failed to allocate the trace buffer");
+    }
+  }
+#endif
+}
+
+bool Trace::isEnabled()
+{
+  return events != NULL;
+}
+
+// Keep a copy of the task's name the first time it records an event, the
+// task may be gone by the time the trace is read
+static void registerThread(TaskHandle_t task)
+{
+  int count = threadCount.load();
+  for (int i = 0; i < count; i++)
+  {
+    if (threads[i].task == task)
+    {
+      return;
+    }
+  }
+  portENTER_CRITICAL(&threadLock);
+  count = threadCount.load();
+  bool known = false;
+  for (int i = 0; i < count; i++)
+  {
+    known = known || threads[i].task == task;
+  }
+  if (!known && count < TRACE_THREADS)
+  {
+    threads[count].task = task;
+    strncpy(threads[count].name, pcTaskGetName(task),
+            configMAX_TASK_NAME_LEN - 1);
+    threadCount = count + 1;
+  }
+  portEXIT_CRITICAL(&threadLock);
+}
+
+void Trace::record(const char *name, char phase)
+{
+  if (events == NULL || readers.load() > 0)
+  {
+    return;
+  }
+  TaskHandle_t task = xTaskGetCurrentTaskHandle();
+  registerThread(task);
+  uint32_t index = recorded.fetch_add(1, std::memory_order_relaxed);
+  TraceEvent &event = events[index % TRACE_EVENTS];
+  event.timestampUs = esp_timer_get_time();
+  event.name = name;
+  event.task = task;
+  event.core = xPortGetCoreID();
+  event.phase = phase;
+}
+
+bool Trace::dump(const char *path)
+{
+  if (events == NULL)
+  {
+    return false;
+  }
+  FILE *file = fopen(path, "w");
+  if (!file)
+  {
+    Serial.printf("Failed to open %s\n", path);
+    return false;
+  }
+  TraceReader reader;
+  uint8_t buffer[512];
+  bool ok = true;
+  size_t length;
+  while (ok && (length = reader.read(buffer, sizeof(buffer))) > 0)
+  {
+    ok = fwrite(buffer, 1, length, file) == length;
+  }
+  fclose(file);
+  return ok;
+}
+
+TraceReader::TraceReader()
+{
+  readers++;
+  mEnd = recorded.load();
+  mNext = mEnd > TRACE_EVENTS ? mEnd - TRACE_EVENTS : 0;
+}
+
+TraceReader::~TraceReader()
+{
+  readers--;
+}
+
+// Work out the next piece of JSON, returns false at the end
+bool TraceReader::nextLine()
+{
+  mLineOffset = 0;
+  mLineLength = 0;
+  if (mStage == 0)
+  {
+    mLineLength = snprintf(mLine, sizeof(mLine), "{\"traceEvents\":[\n");
+    mStage = 1;
+    return true;
+  }
+  // events are grouped by core, each one shows as a process in the viewer
+  while (mStage == 1 && mNext < mEnd && events)
+  {
+    const TraceEvent &event = events[mNext % TRACE_EVENTS];
+    mNext++;
+    if (event.name == NULL)
+    {
+      continue;
+    }
+    mLineLength = snprintf(mLine, sizeof(mLine),
+                           "{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%" PRId64 ","
+                           "\"pid\":%d,\"tid\":%u},\n",
+                           event.name, event.phase, event.timestampUs,
+                           event.core, (uint32_t)(uintptr_t)event.task);
+    return true;
+  }
+  if (mStage == 1)
+  {
+    mStage = 2;
+  }
+  if (mStage == 2 && mThread < threadCount.load() * TRACE_CORES)
+  {
+    const TraceThread &thread = threads[mThread / TRACE_CORES];
+    int core = mThread % TRACE_CORES;
+    mThread++;
+    mLineLength = snprintf(mLine, sizeof(mLine),
+                           "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+                           "\"tid\":%u,\"args\":{\"name\":\"%s\"}},\n",
+                           core, (uint32_t)(uintptr_t)thread.task, thread.name);
+    return true;
+  }
+  if (mStage == 2)
+  {
+    mStage = 3;
+    mThread = 0;
+  }
+  if (mStage == 3 && mThread < TRACE_CORES)
+  {
+    // the last entry has no trailing comma
+    bool last = mThread == TRACE_CORES - 1;
+    mLineLength = snprintf(mLine, sizeof(mLine),
+                           "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+                           "\"args\":{\"name\":\"core %d\"}}%s\n",
+                           mThread, mThread, last ? "\n]}" : ",");
+    mThread++;
+    return true;
+  }
+  return false;
+}
+
+size_t TraceReader::read(uint8_t *buffer, size_t maxLength)
+{
+  size_t length = 0;
+  while (length < maxLength)
+  {
+    if (mLineOffset == mLineLength && !nextLine())
+    {
+      break;
+    }
+    size_t count = min((size_t)(mLineLength - mLineOffset), maxLength - length);
+    memcpy(buffer + length, mLine + mLineOffset, count);
+    mLineOffset += count;
+    length += count;
+  }
+  return length;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Begin and end events for a timeline of what each core was doing, viewable
+// in Perfetto or chrome://tracing. Only recorded when built with -DTRACE,
+// otherwise TRACE_SCOPE compiles to nothing.
+namespace Trace
+{
+  // Allocate the event ring in PSRAM
+  void begin();
+  bool isEnabled();
+  void record(const char *name, char phase);
+  // Write the recorded events to a file as Chrome trace event JSON
+  bool dump(const char *path);
+}
+
+// Records a begin event now and the matching end event when it goes out of
+// scope. The name must be a string literal, only the pointer is kept.
+class TraceScope
+{
+private:
+  const char *mName;
+
+public:
+  TraceScope(const char *name) : mName(name) { Trace::record(name, 'B'); }
+  ~TraceScope() { Trace::record(mName, 'E'); }
+};
+
+#ifdef TRACE
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#else
+#define TRACE_SCOPE(name)
+#endif
+
+// Produces the trace as JSON a piece at a time, e.g. for a chunked HTTP
+// response. Recording is paused while a reader exists so the events being
+// sent aren't overwritten.
+class TraceReader
+{
+private:
+  // header, events, thread names, core names
+  int mStage = 0;
+  uint32_t mNext = 0;
+  uint32_t mEnd = 0;
+  int mThread = 0;
+  char mLine[160];
+  int mLineLength = 0;
+  int mLineOffset = 0;
+
+  bool nextLine();
+
+public:
+  TraceReader();
+  ~TraceReader();
+  // Fill buffer with up to maxLength bytes, returns 0 once it's all been read
+  size_t read(uint8_t *buffer, size_t maxLength);
+};
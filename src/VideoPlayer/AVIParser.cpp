@@ -1,8 +1,10 @@
 #include "AVIParser.h"
+#include "../Trace.h"
 #include <Arduino.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
 typedef struct
 {
@@ -10,10 +12,9 @@ typedef struct
   unsigned int chunkSize;
 } ChunkHeader;
 
-void readChunk(FILE *file, ChunkHeader *header)
+void readChunk(RIFFReader &reader, ChunkHeader *header)
 {
-  fread(&header->chunkId, 4, 1, file);
-  fread(&header->chunkSize, 4, 1, file);
+  reader.read(header, sizeof(ChunkHeader));
   // Serial.printf("ChunkId %c%c%c%c, size %u\n",
   //        header->chunkId[0], header->chunkId[1],
   //        header->chunkId[2], header->chunkId[3],
@@ -21,13 +22,28 @@ void readChunk(FILE *file, ChunkHeader *header)
 }
 
 AVIParser::AVIParser(std::string fname, AVIChunkType requiredChunkType)
-    : mFileName(fname), mRequiredChunkType(requiredChunkType) {}
+    : mFileName(fname), mRequiredChunkType(requiredChunkType)
+{
+  // the index cache sits next to the video, e.g. /sdcard/clip.tti
+  size_t extension = mFileName.find_last_of('.');
+  size_t lastSlash = mFileName.find_last_of('/');
+  if (extension == std::string::npos ||
+      (lastSlash != std::string::npos && extension < lastSlash))
+  {
+    extension = mFileName.length();
+  }
+  mIndexCacheFileName = mFileName.substr(0, extension) + ".tti";
+}
 
 AVIParser::~AVIParser()
 {
-  if (mFile)
+  if (mIndex)
   {
-    fclose(mFile);
+    free(mIndex);
+  }
+  if (mChunkBuffer)
+  {
+    free(mChunkBuffer);
   }
 }
 
@@ -66,63 +82,139 @@ typedef struct
   unsigned int dwSuggestedBufferSize;
 } AVIStreamHeader;
 
+// https://learn.microsoft.com/en-us/windows/win32/api/aviriff/ns-aviriff-avioldindex
+typedef struct
+{
+  char dwChunkId[4];
+  unsigned int dwFlags;
+  unsigned int dwOffset;
+  unsigned int dwSize;
+} AVIOldIndexEntry;
+
+// OpenDML (AVI 2.0) index headers, following the 'indx' / 'ix##' chunk header
+// http://www.jmcgowan.com/odmlff2.pdf
+#define AVI_INDEX_OF_INDEXES 0x00
+#define AVI_INDEX_OF_CHUNKS 0x01
+
+typedef struct __attribute__((packed))
+{
+  unsigned short wLongsPerEntry;
+  unsigned char bIndexSubType;
+  unsigned char bIndexType;
+  unsigned int nEntriesInUse;
+  char dwChunkId[4];
+  unsigned int dwReserved[3];
+} AVISuperIndexHeader;
+
+typedef struct __attribute__((packed))
+{
+  unsigned long long qwOffset;
+  unsigned int dwSize;
+  unsigned int dwDuration;
+} AVISuperIndexEntry;
+
+typedef struct __attribute__((packed))
+{
+  unsigned short wLongsPerEntry;
+  unsigned char bIndexSubType;
+  unsigned char bIndexType;
+  unsigned int nEntriesInUse;
+  char dwChunkId[4];
+  unsigned long long qwBaseOffset;
+  unsigned int dwReserved;
+} AVIStdIndexHeader;
+
+typedef struct
+{
+  unsigned int dwOffset;
+  unsigned int dwSize;
+} AVIStdIndexEntry;
+
+// bit 31 of an AVIStdIndexEntry size flags a non key frame
+#define AVI_STD_INDEX_SIZE_MASK 0x7FFFFFFF
+// number of index entries read from the card at a time
+#define INDEX_READ_BATCH 64
+
+// Header of the .tti index cache, followed by frameCount AVIIndexEntry
+#define INDEX_CACHE_MAGIC "TTI1"
+
+typedef struct
+{
+  char magic[4];
+  // the video file the cache was built from
+  unsigned int fileSize;
+  unsigned int fileTime;
+  unsigned int chunkType;
+  unsigned int dwRate;
+  unsigned int dwScale;
+  unsigned int moviListPosition;
+  unsigned int frameCount;
+} IndexCacheHeader;
+
 bool AVIParser::open()
 {
-  mFile = fopen(mFileName.c_str(), "rb");
-  if (!mFile)
+  if (!mReader.open(mFileName.c_str()))
   {
     Serial.printf("Failed to open file.\n");
     return false;
   }
+  // a valid index cache saves us parsing the headers and index
+  if (loadIndexCache())
+  {
+    Serial.printf("Frame rate: %f\n", mFrameRate);
+    Serial.printf("Loaded %d frame index from %s\n", mFrameCount,
+                  mIndexCacheFileName.c_str());
+    mReader.seek(mMoviListPosition);
+    return true;
+  }
   // check the file is valid
   ChunkHeader header;
   // Read RIFF header
-  readChunk(mFile, &header);
+  readChunk(mReader, &header);
   if (strncmp(header.chunkId, "RIFF", 4) != 0)
   {
     Serial.println("Not a valid AVI file.");
-    fclose(mFile);
-    mFile = NULL;
+    mReader.close();
     return false;
   }
   // next four bytes are the RIFF type which should be 'AVI '
   char riffType[4];
-  fread(&riffType, 4, 1, mFile);
+  mReader.read(riffType, 4);
   if (strncmp(riffType, "AVI ", 4) != 0)
   {
     Serial.println("Not a valid AVI file.");
-    fclose(mFile);
-    mFile = NULL;
+    mReader.close();
     return false;
   }
 
   // now read each chunk and find the movi list
-  while (!feof(mFile) && !ferror(mFile))
+  long moviListEnd = 0;
+  while (!mReader.eof())
   {
-    readChunk(mFile, &header);
-    if (feof(mFile) || ferror(mFile))
+    readChunk(mReader, &header);
+    if (mReader.eof())
     {
       break;
     }
     // is it a LIST chunk?
     if (strncmp(header.chunkId, "LIST", 4) == 0)
     {
-      long listContentPosition = ftell(mFile);
+      long listContentPosition = mReader.tell();
       char listType[4];
-      fread(&listType, 4, 1, mFile);
+      mReader.read(listType, 4);
 
       if (strncmp(listType, "hdrl", 4) == 0)
       {
         // We are inside the 'hdrl' LIST chunk. Its content starts at
-        // ftell(mFile) and ends at listContentPosition + header.chunkSize.
+        // mReader.tell() and ends at listContentPosition + header.chunkSize.
         long hdrlContentRemaining =
             header.chunkSize - 4; // -4 for 'hdrl' type already read
 
-        while (hdrlContentRemaining > 0 && !feof(mFile) && !ferror(mFile))
+        while (hdrlContentRemaining > 0 && !mReader.eof())
         {
           ChunkHeader subHeader;
           long bytesReadForSubHeader =
-              fread(&subHeader, 1, sizeof(ChunkHeader), mFile);
+              mReader.read(&subHeader, sizeof(ChunkHeader));
           if (bytesReadForSubHeader != sizeof(ChunkHeader))
           {
             // Error or EOF
@@ -141,13 +233,13 @@ bool AVIParser::open()
           if (strncmp(subHeader.chunkId, "avih", 4) == 0)
           {
             // We don't need to read avih content.
-            fseek(mFile, subChunkDataSize, SEEK_CUR);
+            mReader.skip(subChunkDataSize);
             hdrlContentRemaining -= subChunkTotalSize;
           }
           else if (strncmp(subHeader.chunkId, "LIST", 4) == 0)
           {
             char subListType[4];
-            long bytesReadForSubListType = fread(&subListType, 1, 4, mFile);
+            long bytesReadForSubListType = mReader.read(subListType, 4);
             if (bytesReadForSubListType != 4)
             {
               // Error or EOF
@@ -159,12 +251,13 @@ bool AVIParser::open()
             if (strncmp(subListType, "strl", 4) == 0)
             {
               long strlContentRemaining = subChunkDataSize;
-              while (strlContentRemaining > 0 && !feof(mFile) &&
-                     !ferror(mFile))
+              // set once the strh shows this is the stream we want
+              bool isRequiredStream = false;
+              while (strlContentRemaining > 0 && !mReader.eof())
               {
                 ChunkHeader strhHeader;
                 long bytesReadForStrhHeader =
-                    fread(&strhHeader, 1, sizeof(ChunkHeader), mFile);
+                    mReader.read(&strhHeader, sizeof(ChunkHeader));
                 if (bytesReadForStrhHeader != sizeof(ChunkHeader))
                 {
                   // Error or EOF
@@ -183,7 +276,7 @@ bool AVIParser::open()
                 {
                   AVIStreamHeader strh;
                   long bytesReadForStrh =
-                      fread(&strh, 1, sizeof(AVIStreamHeader), mFile);
+                      mReader.read(&strh, sizeof(AVIStreamHeader));
                   if (bytesReadForStrh != sizeof(AVIStreamHeader))
                   {
                     // Error or EOF
@@ -192,6 +285,12 @@ bool AVIParser::open()
                   strhDataSize -=
                       bytesReadForStrh; // Account for strh struct read
 
+                  isRequiredStream =
+                      strncmp(strh.fccType,
+                              mRequiredChunkType == AVIChunkType::VIDEO
+                                  ? "vids"
+                                  : "auds",
+                              4) == 0;
                   if (strncmp(strh.fccType, "vids", 4) == 0)
                   {
                     if (strh.dwScale == 0)
@@ -202,18 +301,26 @@ bool AVIParser::open()
                     }
                     else
                     {
+                      mRate = strh.dwRate;
+                      mScale = strh.dwScale;
                       mFrameRate = (float)strh.dwRate / strh.dwScale;
                       Serial.printf("Frame rate: %f\n", mFrameRate);
                     }
                   }
-                  fseek(mFile, strhDataSize,
-                        SEEK_CUR); // Skip remaining strh data
+                  mReader.skip(strhDataSize); // Skip remaining strh data
                   strlContentRemaining -= strhTotalSize;
                 }
                 else
                 {
+                  if (isRequiredStream && mSuperIndexPosition == 0 &&
+                      strncmp(strhHeader.chunkId, "indx", 4) == 0)
+                  {
+                    // OpenDML super index, loaded once we've found movi
+                    mSuperIndexPosition = mReader.tell();
+                    mSuperIndexLength = strhDataSize;
+                  }
                   // Not 'strh', skip its content
-                  fseek(mFile, strhDataSize, SEEK_CUR);
+                  mReader.skip(strhDataSize);
                   strlContentRemaining -= strhTotalSize;
                 }
               }
@@ -223,14 +330,14 @@ bool AVIParser::open()
             else
             {
               // Not 'strl', skip the rest of this LIST chunk's content
-              fseek(mFile, subChunkDataSize, SEEK_CUR);
+              mReader.skip(subChunkDataSize);
               hdrlContentRemaining -= subChunkTotalSize;
             }
           }
           else
           {
             // Not 'avih' or 'LIST', skip its content
-            fseek(mFile, subChunkDataSize, SEEK_CUR);
+            mReader.skip(subChunkDataSize);
             hdrlContentRemaining -= subChunkTotalSize;
           }
         }
@@ -239,10 +346,13 @@ bool AVIParser::open()
       {
         // This is the movie list. We've found what we're looking for.
         Serial.printf("Found movi list.\n");
-        mMoviListPosition =
-            ftell(mFile); // The current position is the start of the movi data
+        // The current position is the start of the movi data
+        mMoviListPosition = mReader.tell();
         mMoviListLength = header.chunkSize - 4;
         Serial.printf("List Chunk Length: %ld\n", mMoviListLength);
+        // The legacy idx1 index, if any, follows the movi list.
+        moviListEnd = listContentPosition + header.chunkSize +
+                      (header.chunkSize % 2);
         // We can stop parsing the file now.
         break;
       }
@@ -250,20 +360,20 @@ bool AVIParser::open()
       {
         // This is some other kind of LIST chunk that we don't care about. Skip
         // it.
-        fseek(mFile, header.chunkSize - 4, SEEK_CUR);
+        mReader.skip(header.chunkSize - 4);
         if (header.chunkSize % 2 != 0)
         {
-          fseek(mFile, 1, SEEK_CUR);
+          mReader.skip(1);
         }
       }
     }
     else
     {
       // This is not a LIST chunk. Skip it.
-      fseek(mFile, header.chunkSize, SEEK_CUR);
+      mReader.skip(header.chunkSize);
       if (header.chunkSize % 2 != 0)
       {
-        fseek(mFile, 1, SEEK_CUR);
+        mReader.skip(1);
       }
     }
   }
@@ -271,21 +381,352 @@ bool AVIParser::open()
   if (mMoviListPosition == 0)
   {
     Serial.printf("Failed to find the movi list.\n");
-    fclose(mFile);
-    mFile = NULL;
+    mReader.close();
     return false;
   }
 
+  // Load the frame index for random access. The OpenDML index is preferred as
+  // idx1 only covers the first RIFF segment of files over 1GB.
+  if (mSuperIndexPosition == 0 || !loadSuperIndex())
+  {
+    mFrameCount = 0;
+    mReader.seek(moviListEnd);
+    readChunk(mReader, &header);
+    if (!mReader.eof() && strncmp(header.chunkId, "idx1", 4) == 0)
+    {
+      loadLegacyIndex(mReader.tell(), header.chunkSize);
+    }
+  }
+  if (mFrameCount > 0)
+  {
+    Serial.printf("Indexed %d frames\n", mFrameCount);
+    mIndexComplete = true;
+    saveIndexCache();
+  }
+  else
+  {
+    // the index is built as we play through the file and cached once done
+    Serial.println("No index found, playback will be sequential only.");
+  }
+  mReader.clearEof();
+
   // Before we return, we must position the file pointer at the start of the
   // movi data.
-  fseek(mFile, mMoviListPosition, SEEK_SET);
+  mReader.seek(mMoviListPosition);
   return true;
 }
 
-size_t AVIParser::getNextChunk(uint8_t **buffer, size_t &bufferLength)
+bool AVIParser::isRequiredChunk(const char *chunkId)
+{
+  if (mRequiredChunkType == AVIChunkType::VIDEO)
+  {
+    return chunkId[2] == 'd' && (chunkId[3] == 'c' || chunkId[3] == 'b');
+  }
+  return chunkId[2] == 'w' && chunkId[3] == 'b';
+}
+
+bool AVIParser::appendIndexEntry(uint32_t offset, uint32_t size)
+{
+  if (mFrameCount == mIndexCapacity)
+  {
+    int capacity = mIndexCapacity > 0 ? mIndexCapacity * 2 : 1024;
+    AVIIndexEntry *newIndex =
+        (AVIIndexEntry *)realloc(mIndex, capacity * sizeof(AVIIndexEntry));
+    if (!newIndex)
+    {
+      Serial.printf("realloc failed for %d index entries\n", capacity);
+      return false;
+    }
+    mIndex = newIndex;
+    mIndexCapacity = capacity;
+  }
+  mIndex[mFrameCount].offset = offset;
+  mIndex[mFrameCount].size = size;
+  mFrameCount++;
+  return true;
+}
+
+bool AVIParser::loadLegacyIndex(long indexPosition, long indexLength)
+{
+  mReader.seek(indexPosition);
+  long entriesRemaining = indexLength / sizeof(AVIOldIndexEntry);
+  // idx1 offsets point at the chunk header and are normally relative to the
+  // 'movi' fourcc, but some muxers write absolute file offsets. We work out
+  // which from the first entry we need.
+  long moviStart = mMoviListPosition - 4;
+  long baseOffset = -1;
+  AVIOldIndexEntry entries[INDEX_READ_BATCH];
+  while (entriesRemaining > 0)
+  {
+    int batch = entriesRemaining < INDEX_READ_BATCH ? entriesRemaining
+                                                     : INDEX_READ_BATCH;
+    size_t batchSize = batch * sizeof(AVIOldIndexEntry);
+    if (mReader.read(entries, batchSize) != batchSize)
+    {
+      Serial.println("Truncated idx1 index.");
+      break;
+    }
+    entriesRemaining -= batch;
+    for (int i = 0; i < batch; i++)
+    {
+      if (!isRequiredChunk(entries[i].dwChunkId))
+      {
+        continue;
+      }
+      if (baseOffset < 0)
+      {
+        long batchEnd = mReader.tell();
+        ChunkHeader header;
+        mReader.seek(moviStart + entries[i].dwOffset);
+        readChunk(mReader, &header);
+        baseOffset =
+            strncmp(header.chunkId, entries[i].dwChunkId, 4) == 0 ? moviStart
+                                                                   : 0;
+        mReader.seek(batchEnd);
+      }
+      if (!appendIndexEntry(baseOffset + entries[i].dwOffset + 8,
+                            entries[i].dwSize))
+      {
+        mFrameCount = 0;
+        return false;
+      }
+    }
+  }
+  return mFrameCount > 0;
+}
+
+bool AVIParser::loadSuperIndex()
+{
+  mReader.seek(mSuperIndexPosition);
+  AVISuperIndexHeader superHeader;
+  if (mReader.read(&superHeader, sizeof(AVISuperIndexHeader)) !=
+          sizeof(AVISuperIndexHeader) ||
+      superHeader.bIndexType != AVI_INDEX_OF_INDEXES ||
+      superHeader.wLongsPerEntry != 4)
+  {
+    Serial.println("Unsupported OpenDML super index.");
+    return false;
+  }
+  long maxEntries = (mSuperIndexLength - (long)sizeof(AVISuperIndexHeader)) /
+                    (long)sizeof(AVISuperIndexEntry);
+  int superEntryCount = superHeader.nEntriesInUse;
+  if (superEntryCount > maxEntries)
+  {
+    superEntryCount = maxEntries;
+  }
+  for (int s = 0; s < superEntryCount; s++)
+  {
+    AVISuperIndexEntry superEntry;
+    mReader.seek(mSuperIndexPosition + sizeof(AVISuperIndexHeader) +
+                 s * sizeof(AVISuperIndexEntry));
+    if (mReader.read(&superEntry, sizeof(AVISuperIndexEntry)) !=
+        sizeof(AVISuperIndexEntry))
+    {
+      return false;
+    }
+    // each entry points at an 'ix##' standard index chunk
+    ChunkHeader header;
+    AVIStdIndexHeader stdHeader;
+    mReader.seek(superEntry.qwOffset);
+    readChunk(mReader, &header);
+    if (strncmp(header.chunkId, "ix", 2) != 0 ||
+        mReader.read(&stdHeader, sizeof(AVIStdIndexHeader)) !=
+            sizeof(AVIStdIndexHeader) ||
+        stdHeader.bIndexType != AVI_INDEX_OF_CHUNKS ||
+        stdHeader.wLongsPerEntry != 2)
+    {
+      Serial.println("Invalid OpenDML standard index.");
+      return false;
+    }
+    // standard index offsets point at the chunk data, not its header
+    long entriesRemaining = stdHeader.nEntriesInUse;
+    AVIStdIndexEntry entries[INDEX_READ_BATCH];
+    while (entriesRemaining > 0)
+    {
+      int batch = entriesRemaining < INDEX_READ_BATCH ? entriesRemaining
+                                                       : INDEX_READ_BATCH;
+      size_t batchSize = batch * sizeof(AVIStdIndexEntry);
+      if (mReader.read(entries, batchSize) != batchSize)
+      {
+        return false;
+      }
+      entriesRemaining -= batch;
+      for (int i = 0; i < batch; i++)
+      {
+        unsigned long long offset =
+            stdHeader.qwBaseOffset + entries[i].dwOffset;
+        if (offset > UINT32_MAX)
+        {
+          // FAT32 files can't be this large anyway
+          return mFrameCount > 0;
+        }
+        if (!appendIndexEntry((uint32_t)offset,
+                              entries[i].dwSize & AVI_STD_INDEX_SIZE_MASK))
+        {
+          return false;
+        }
+      }
+    }
+  }
+  return mFrameCount > 0;
+}
+
+bool AVIParser::loadIndexCache()
+{
+  struct stat fileStat;
+  if (stat(mFileName.c_str(), &fileStat) != 0)
+  {
+    return false;
+  }
+  FILE *cacheFile = fopen(mIndexCacheFileName.c_str(), "rb");
+  if (!cacheFile)
+  {
+    return false;
+  }
+  IndexCacheHeader header;
+  bool valid = fread(&header, sizeof(IndexCacheHeader), 1, cacheFile) == 1 &&
+               strncmp(header.magic, INDEX_CACHE_MAGIC, 4) == 0 &&
+               header.fileSize == (unsigned int)fileStat.st_size &&
+               header.fileTime == (unsigned int)fileStat.st_mtime &&
+               header.chunkType == (unsigned int)mRequiredChunkType &&
+               header.frameCount > 0;
+  if (valid)
+  {
+    AVIIndexEntry *index =
+        (AVIIndexEntry *)malloc(header.frameCount * sizeof(AVIIndexEntry));
+    valid = index && fread(index, sizeof(AVIIndexEntry), header.frameCount,
+                           cacheFile) == header.frameCount;
+    if (valid)
+    {
+      free(mIndex);
+      mIndex = index;
+      mIndexCapacity = header.frameCount;
+      mFrameCount = header.frameCount;
+    }
+    else
+    {
+      free(index);
+    }
+  }
+  fclose(cacheFile);
+  if (!valid)
+  {
+    Serial.printf("Ignoring stale index cache %s\n",
+                  mIndexCacheFileName.c_str());
+    return false;
+  }
+  mRate = header.dwRate;
+  mScale = header.dwScale;
+  mFrameRate = mScale > 0 ? (float)mRate / mScale : 0;
+  mMoviListPosition = header.moviListPosition;
+  // only needed to walk the movi list, which the index replaces
+  mMoviListLength = 0;
+  mIndexComplete = true;
+  return true;
+}
+
+void AVIParser::saveIndexCache()
+{
+  struct stat fileStat;
+  if (stat(mFileName.c_str(), &fileStat) != 0)
+  {
+    return;
+  }
+  FILE *cacheFile = fopen(mIndexCacheFileName.c_str(), "wb");
+  if (!cacheFile)
+  {
+    // e.g. the card is write protected, we'll just index again next time
+    Serial.printf("Can't write index cache %s\n", mIndexCacheFileName.c_str());
+    return;
+  }
+  IndexCacheHeader header;
+  memcpy(header.magic, INDEX_CACHE_MAGIC, 4);
+  header.fileSize = fileStat.st_size;
+  header.fileTime = fileStat.st_mtime;
+  header.chunkType = (unsigned int)mRequiredChunkType;
+  header.dwRate = mRate;
+  header.dwScale = mScale;
+  header.moviListPosition = mMoviListPosition;
+  header.frameCount = mFrameCount;
+  bool written =
+      fwrite(&header, sizeof(IndexCacheHeader), 1, cacheFile) == 1 &&
+      fwrite(mIndex, sizeof(AVIIndexEntry), mFrameCount, cacheFile) ==
+          (size_t)mFrameCount;
+  written = fclose(cacheFile) == 0 && written;
+  if (!written)
+  {
+    // don't leave a truncated cache behind
+    Serial.printf("Failed to write index cache %s\n",
+                  mIndexCacheFileName.c_str());
+    remove(mIndexCacheFileName.c_str());
+  }
+}
+
+bool AVIParser::seekToFrame(int frame)
+{
+  if (!mIndexComplete || frame < 0 || frame > mFrameCount)
+  {
+    return false;
+  }
+  mNextFrame = frame;
+  return true;
+}
+
+size_t AVIParser::getFrameSize(int frame)
+{
+  if (!mIndexComplete || frame < 0 || frame >= mFrameCount)
+  {
+    return 0;
+  }
+  return mIndex[frame].size;
+}
+
+size_t AVIParser::readChunkData(size_t length, uint8_t **buffer,
+                                size_t &bufferLength)
+{
+  TRACE_SCOPE("avi read");
+  if (length > bufferLength)
+  {
+    uint8_t *newBuf = (uint8_t *)realloc(*buffer, length);
+    if (!newBuf)
+    {
+      Serial.printf("realloc failed for chunk size=%zu\n", length);
+      return 0;
+    }
+    *buffer = newBuf;
+    bufferLength = length;
+  }
+  if (mReader.read(*buffer, length) != length)
+  {
+    Serial.printf("fread failed for chunk size=%zu\n", length);
+    return 0;
+  }
+  // handle any padding bytes
+  mReader.skip(length % 2);
+  return length;
+}
+
+size_t AVIParser::readFrame(int frame, uint8_t **buffer, size_t &bufferLength)
+{
+  if (!mReader.isOpen() || !mIndexComplete || frame < 0 ||
+      frame >= mFrameCount)
+  {
+    return 0;
+  }
+  mNextFrame = frame + 1;
+  const AVIIndexEntry &entry = mIndex[frame];
+  if (entry.size == 0)
+  {
+    return 0;
+  }
+  mReader.seek(entry.offset);
+  return readChunkData(entry.size, buffer, bufferLength);
+}
+
+size_t AVIParser::findNextChunk()
 {
   // check if the file is open
-  if (!mFile)
+  if (!mReader.isOpen())
   {
     Serial.println("No file open.");
     return 0;
@@ -296,11 +737,30 @@ size_t AVIParser::getNextChunk(uint8_t **buffer, size_t &bufferLength)
     Serial.println("No movi list found.");
     return 0;
   }
+  // with an index we can go straight to the next frame, skipping empty ones
+  if (mIndexComplete)
+  {
+    while (mNextFrame < mFrameCount)
+    {
+      const AVIIndexEntry &entry = mIndex[mNextFrame++];
+      if (entry.size > 0)
+      {
+        mReader.seek(entry.offset);
+        return entry.size;
+      }
+    }
+    Serial.println("No more data");
+    return 0;
+  }
   // get the next chunk of data from the list
   ChunkHeader header;
   while (mMoviListLength > 0)
   {
-    readChunk(mFile, &header);
+    readChunk(mReader, &header);
+    if (mReader.eof())
+    {
+      break;
+    }
     mMoviListLength -= 8;
 
     static uint32_t dbgChunkPrints = 0;
@@ -312,150 +772,83 @@ size_t AVIParser::getNextChunk(uint8_t **buffer, size_t &bufferLength)
       dbgChunkPrints++;
     }
 
+    long paddedSize = header.chunkSize + (header.chunkSize % 2);
     if (strncmp(header.chunkId, "LIST", 4) == 0)
     {
       char listType[4];
-      if (fread(&listType, 4, 1, mFile) != 1)
+      if (mReader.read(listType, 4) != 4)
       {
         return 0;
       }
       mMoviListLength -= 4;
-      long listRemaining = (long)header.chunkSize - 4;
-
-      if (strncmp(listType, "rec ", 4) == 0)
+      // the chunks of a 'rec ' list are read as if they were directly in
+      // the movi list, any other list is skipped
+      if (strncmp(listType, "rec ", 4) != 0)
       {
-        while (listRemaining > 0 && mMoviListLength > 0)
-        {
-          ChunkHeader subHeader;
-          readChunk(mFile, &subHeader);
-          listRemaining -= 8;
-          mMoviListLength -= 8;
-
-          bool isVideoChunk = strncmp(subHeader.chunkId, "00dc", 4) == 0;
-          bool isAudioChunk =
-              (subHeader.chunkId[2] == 'w' && subHeader.chunkId[3] == 'b');
-          isVideoChunk =
-              (subHeader.chunkId[2] == 'd' &&
-               (subHeader.chunkId[3] == 'c' || subHeader.chunkId[3] == 'b'));
-          if (mRequiredChunkType == AVIChunkType::VIDEO && isVideoChunk ||
-              mRequiredChunkType == AVIChunkType::AUDIO && isAudioChunk)
-          {
-            if (subHeader.chunkSize == 0)
-            {
-              continue;
-            }
-            if (subHeader.chunkSize > bufferLength)
-            {
-              uint8_t *newBuf =
-                  (uint8_t *)realloc(*buffer, subHeader.chunkSize);
-              if (!newBuf)
-              {
-                Serial.printf("realloc failed for chunk size=%u\n",
-                              subHeader.chunkSize);
-                return 0;
-              }
-              *buffer = newBuf;
-              bufferLength = subHeader.chunkSize;
-            }
-            if (fread(*buffer, subHeader.chunkSize, 1, mFile) != 1)
-            {
-              Serial.printf("fread failed for chunk size=%u\n",
-                            subHeader.chunkSize);
-              Serial.printf("fread failed for chunk size=%u\n",
-                            subHeader.chunkSize);
-              return 0;
-            }
-            listRemaining -= subHeader.chunkSize;
-            mMoviListLength -= subHeader.chunkSize;
-            if (subHeader.chunkSize % 2 != 0)
-            {
-              fseek(mFile, 1, SEEK_CUR);
-              listRemaining--;
-              mMoviListLength--;
-            }
-            return subHeader.chunkSize;
-          }
-          else
-          {
-            fseek(mFile, subHeader.chunkSize, SEEK_CUR);
-            listRemaining -= subHeader.chunkSize;
-            mMoviListLength -= subHeader.chunkSize;
-          }
-          if (subHeader.chunkSize % 2 != 0)
-          {
-            fseek(mFile, 1, SEEK_CUR);
-            listRemaining--;
-            mMoviListLength--;
-          }
-        }
-      }
-      else
-      {
-        fseek(mFile, listRemaining, SEEK_CUR);
-        mMoviListLength -= listRemaining;
-      }
-
-      if (header.chunkSize % 2 != 0)
-      {
-        fseek(mFile, 1, SEEK_CUR);
-        mMoviListLength--;
+        mReader.skip(paddedSize - 4);
+        mMoviListLength -= paddedSize - 4;
       }
       continue;
     }
-
-    bool isAudioChunk = (header.chunkId[2] == 'w' && header.chunkId[3] == 'b');
-    bool isVideoChunk =
-        (header.chunkId[2] == 'd' &&
-         (header.chunkId[3] == 'c' || header.chunkId[3] == 'b'));
-    if (mRequiredChunkType == AVIChunkType::VIDEO && isVideoChunk ||
-        mRequiredChunkType == AVIChunkType::AUDIO && isAudioChunk)
+    // the caller consumes the data and padding of the chunk we return
+    mMoviListLength -= paddedSize;
+    if (isRequiredChunk(header.chunkId))
     {
-      // we've got the required chunk - copy it into the provided buffer
-      // reallocate the buffer if necessary
-      if (header.chunkSize == 0)
+      // record the chunk in the index we're building as we go
+      if (!mIndexBuildFailed)
       {
-        continue;
+        mIndexBuildFailed =
+            !appendIndexEntry(mReader.tell(), header.chunkSize);
       }
-      if (header.chunkSize > bufferLength)
+      mNextFrame++;
+      if (header.chunkSize > 0)
       {
-        uint8_t *newBuf = (uint8_t *)realloc(*buffer, header.chunkSize);
-        if (!newBuf)
-        {
-          Serial.printf("realloc failed for chunk size=%u\n", header.chunkSize);
-          return 0;
-        }
-        *buffer = newBuf;
-        bufferLength = header.chunkSize;
+        return header.chunkSize;
       }
-      // copy the chunk data
-      if (fread(*buffer, header.chunkSize, 1, mFile) != 1)
-      {
-        Serial.printf("fread failed for chunk size=%u\n", header.chunkSize);
-        return 0;
-      }
-      mMoviListLength -= header.chunkSize;
-      // handle any padding bytes
-      if (header.chunkSize % 2 != 0)
-      {
-        fseek(mFile, 1, SEEK_CUR);
-        mMoviListLength--;
-      }
-      return header.chunkSize;
-    }
-    else
-    {
-      // the data is not what was required - skip over the chunk
-      fseek(mFile, header.chunkSize, SEEK_CUR);
-      mMoviListLength -= header.chunkSize;
-    }
-    // handle any padding bytes
-    if (header.chunkSize % 2 != 0)
-    {
-      fseek(mFile, 1, SEEK_CUR);
-      mMoviListLength--;
     }
+    // the data is not what was required - skip over the chunk
+    mReader.skip(paddedSize);
+  }
+  // we've now seen every chunk, so the index is complete
+  if (mMoviListLength <= 0 && !mIndexBuildFailed && mFrameCount > 0)
+  {
+    Serial.printf("Indexed %d frames\n", mFrameCount);
+    mIndexComplete = true;
+    saveIndexCache();
   }
   // no more chunks
   Serial.println("No more data");
   return 0;
-}
\ No newline at end of file
+}
+
+size_t AVIParser::getNextChunk(uint8_t **buffer, size_t &bufferLength)
+{
+  size_t length = findNextChunk();
+  if (length == 0)
+  {
+    return 0;
+  }
+  return readChunkData(length, buffer, bufferLength);
+}
+
+size_t AVIParser::getNextChunk(const uint8_t **data)
+{
+  size_t length = findNextChunk();
+  if (length == 0)
+  {
+    return 0;
+  }
+  // chunks that sit in the read buffer are handed out in place
+  *data = mReader.view(length);
+  if (*data)
+  {
+    mReader.skip(length % 2);
+    return length;
+  }
+  if (readChunkData(length, &mChunkBuffer, mChunkBufferLength) != length)
+  {
+    return 0;
+  }
+  *data = mChunkBuffer;
+  return length;
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "RIFFReader.h"
+#include <stdint.h>
 #include <stdio.h>
 #include <string>
 
@@ -9,20 +11,73 @@ enum class AVIChunkType
   AUDIO
 };
 
+// Position of a chunk's payload in the file, taken from the idx1 or OpenDML
+// index. A size of 0 is a dropped frame that repeats the previous one.
+typedef struct
+{
+  uint32_t offset;
+  uint32_t size;
+} AVIIndexEntry;
+
 class AVIParser
 {
 private:
   std::string mFileName;
+  std::string mIndexCacheFileName;
   AVIChunkType mRequiredChunkType;
-  FILE *mFile = NULL;
+  RIFFReader mReader;
   long mMoviListPosition = 0;
   long mMoviListLength;
   float mFrameRate = 0;
+  unsigned int mRate = 0;
+  unsigned int mScale = 0;
+  // position and size of the OpenDML 'indx' chunk of the required stream
+  long mSuperIndexPosition = 0;
+  long mSuperIndexLength = 0;
+  // one entry per chunk of the required type. Files without an index get
+  // theirs built while they are read sequentially.
+  AVIIndexEntry *mIndex = NULL;
+  int mIndexCapacity = 0;
+  int mFrameCount = 0;
+  int mNextFrame = 0;
+  bool mIndexComplete = false;
+  bool mIndexBuildFailed = false;
+  // holds chunks too large to be returned in place from the read buffer
+  uint8_t *mChunkBuffer = NULL;
+  size_t mChunkBufferLength = 0;
+
+  bool isRequiredChunk(const char *chunkId);
+  bool appendIndexEntry(uint32_t offset, uint32_t size);
+  bool loadLegacyIndex(long indexPosition, long indexLength);
+  bool loadSuperIndex();
+  size_t findNextChunk();
+  bool loadIndexCache();
+  void saveIndexCache();
+  size_t readChunkData(size_t length, uint8_t **buffer, size_t &bufferLength);
 
 public:
   AVIParser(std::string fname, AVIChunkType requiredChunkType);
   ~AVIParser();
   bool open();
   size_t getNextChunk(uint8_t **buffer, size_t &bufferLength);
+  // Zero-copy variant of getNextChunk(), the returned data is only valid until
+  // the next call to the parser.
+  size_t getNextChunk(const uint8_t **data);
   float getFrameRate() { return mFrameRate; };
+  // stream time base, one frame lasts scale / rate seconds
+  unsigned int getRate() { return mRate; }
+  unsigned int getScale() { return mScale; }
+  // Number of indexed frames, 0 if the file has no usable index (yet) and can
+  // only be read sequentially with getNextChunk().
+  int getFrameCount() { return mIndexComplete ? mFrameCount : 0; }
+  // Index of the frame the next call to getNextChunk() will return.
+  int getNextFrameIndex() { return mNextFrame; }
+  // Make getNextChunk() continue from the given frame, or from the frame
+  // count to have it return no more. Requires an index.
+  bool seekToFrame(int frame);
+  // Size of an indexed frame, 0 for an empty one
+  size_t getFrameSize(int frame);
+  // Read the given frame into the buffer, growing it if necessary. Returns the
+  // frame length, 0 for an empty (dropped) frame or on error.
+  size_t readFrame(int frame, uint8_t **buffer, size_t &bufferLength);
 };
\ No newline at end of file
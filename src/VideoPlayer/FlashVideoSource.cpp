@@ -0,0 +1,134 @@
+#include "FlashVideoSource.h"
+#include "../FlashLibrary.h"
+#include <Arduino.h>
+
+// the frame on screen, the one being decoded and one on its way
+const int FLASH_FRAME_SLOTS = 3;
+
+FlashVideoSource::FlashVideoSource(FlashLibrary *library)
+    : mLibrary(library), mFramePool(FLASH_FRAME_SLOTS)
+{
+}
+
+bool FlashVideoSource::fetchVideoData()
+{
+  if (!mLibrary->isMounted())
+  {
+    return false;
+  }
+  mVideos.clear();
+  for (int entry : mLibrary->findEntries(MediaType::VIDEO))
+  {
+    const MediaImageEntry *video = mLibrary->getEntry(entry);
+    mVideos.push_back({.entry = entry,
+                       .name = std::string(video->name,
+                                           strnlen(video->name,
+                                                   sizeof(video->name))),
+                       .rate = video->rate,
+                       .scale = video->scale,
+                       .frameCount = (int)video->frameCount});
+  }
+  if (mVideos.size() == 0)
+  {
+    Serial.println("No videos in flash");
+    return false;
+  }
+  return true;
+}
+
+void FlashVideoSource::setState(MediaPlayerState state)
+{
+  MediaPlayerState oldState = mState;
+  VideoSource::setState(state);
+  if (state == MediaPlayerState::PAUSED)
+  {
+    mClock.pause();
+  }
+  else if (state == MediaPlayerState::PLAYING &&
+           oldState == MediaPlayerState::PAUSED)
+  {
+    mClock.resume();
+  }
+  else
+  {
+    mClock.reset();
+  }
+}
+
+void FlashVideoSource::setChannel(int channel)
+{
+  if (channel < 0 || channel >= (int)mVideos.size())
+  {
+    Serial.printf("Invalid channel %d\n", channel);
+    return;
+  }
+  const FlashVideo &video = mVideos[channel];
+  Serial.printf("Playing %s from flash\n", video.name.c_str());
+  mClock.setTimeBase(video.rate, video.scale);
+  mNextFrame = 0;
+  mChannelNumber = channel;
+}
+
+void FlashVideoSource::nextChannel()
+{
+  int channel = mChannelNumber + 1;
+  if (channel >= (int)mVideos.size())
+  {
+    mWrapped = true;
+    channel = 0;
+  }
+  setChannel(channel);
+}
+
+FrameHandle FlashVideoSource::getVideoFrame()
+{
+  if (mChannelNumber < 0 || mChannelNumber >= (int)mVideos.size())
+  {
+    return FrameHandle();
+  }
+  if (mState != MediaPlayerState::PLAYING || mLibrary->isWriting())
+  {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+    return FrameHandle();
+  }
+  int entry = mVideos[mChannelNumber].entry;
+  int frameCount = mVideos[mChannelNumber].frameCount;
+  // any frame costs nothing to get at, so if we've fallen behind the clock
+  // go straight to the one that's due
+  int dueFrame = min(mClock.currentFrame(), frameCount);
+  if (dueFrame > mNextFrame)
+  {
+    mClock.framesDropped(dueFrame - mNextFrame);
+    mNextFrame = dueFrame;
+  }
+  if (mNextFrame >= frameCount)
+  {
+    // end of video, move to next one
+    nextChannel();
+    return FrameHandle();
+  }
+  if (mClock.waitUntilDue(mNextFrame))
+  {
+    // the player has a command to see to, this frame will still be here
+    return FrameHandle();
+  }
+  const uint8_t *data;
+  size_t length = mLibrary->getFrame(entry, mNextFrame, &data);
+  mClock.framePresented(mNextFrame);
+  mNextFrame++;
+  if (length == 0)
+  {
+    // an empty frame repeats the one before
+    return FrameHandle();
+  }
+  return mFramePool.wrap(data, length, 0);
+}
+
+std::string FlashVideoSource::getChannelName()
+{
+  if (mChannelNumber < 0 || mChannelNumber >= (int)mVideos.size())
+  {
+    return "Unknown";
+  }
+  return mVideos[mChannelNumber].name;
+}
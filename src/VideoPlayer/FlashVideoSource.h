@@ -0,0 +1,54 @@
+#pragma once
+
+#include "PresentationClock.h"
+#include "VideoSource.h"
+#include <string>
+#include <vector>
+
+class FlashLibrary;
+
+// What's needed of a video's entry, copied when the library is read so
+// nothing depends on the mapped image while an upload overwrites it
+typedef struct
+{
+  // index in the library
+  int entry;
+  std::string name;
+  uint32_t rate;
+  uint32_t scale;
+  int frameCount;
+} FlashVideo;
+
+// Plays the videos in the flash library. Frames are already in memory, so
+// there's no reader task, each one is handed over when it's due.
+class FlashVideoSource : public VideoSource
+{
+private:
+  FlashLibrary *mLibrary;
+  // the videos in the library, one per channel
+  std::vector<FlashVideo> mVideos;
+  int mNextFrame = 0;
+  volatile bool mWrapped = false;
+  // frames only borrow the mapped flash, the slots are for reference counts
+  FramePool mFramePool;
+  PresentationClock mClock;
+
+public:
+  FlashVideoSource(FlashLibrary *library);
+  void start() {}
+  bool fetchVideoData();
+  int getChannelCount() { return mVideos.size(); };
+  std::string getChannelName();
+  // see superclass for documentation
+  FrameHandle getVideoFrame();
+  void setChannel(int channel);
+  void nextChannel();
+  void setState(MediaPlayerState state) override;
+  PresentationClockStats getClockStats() { return mClock.getStats(); }
+  bool consumeWrapped() override
+  {
+    bool wrapped = mWrapped;
+    mWrapped = false;
+    return wrapped;
+  }
+};
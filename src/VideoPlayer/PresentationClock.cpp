@@ -0,0 +1,160 @@
+#include "PresentationClock.h"
+#include "../Metrics.h"
+#include <esp_timer.h>
+
+// frames are handed over on time to within scheduling noise, so a frame only
+// counts as late once it's more than a tick past due
+const int64_t LATE_TOLERANCE_US = portTICK_PERIOD_MS * 1000;
+
+int64_t PresentationClock::nowUs()
+{
+  // while paused, time stands still at the moment we paused
+  return mPausedAtUs != 0 ? mPausedAtUs : esp_timer_get_time();
+}
+
+int64_t PresentationClock::ptsUs(int frame)
+{
+  return (int64_t)frame * mScale * 1000000 / mRate;
+}
+
+void PresentationClock::setTimeBase(unsigned int rate, unsigned int scale)
+{
+  portENTER_CRITICAL(&mLock);
+  mRate = rate;
+  mScale = scale;
+  mRunning = false;
+  portEXIT_CRITICAL(&mLock);
+}
+
+void PresentationClock::reset()
+{
+  portENTER_CRITICAL(&mLock);
+  mRunning = false;
+  mPausedAtUs = 0;
+  portEXIT_CRITICAL(&mLock);
+}
+
+void PresentationClock::pause()
+{
+  portENTER_CRITICAL(&mLock);
+  if (mPausedAtUs == 0)
+  {
+    mPausedAtUs = esp_timer_get_time();
+  }
+  portEXIT_CRITICAL(&mLock);
+}
+
+void PresentationClock::resume()
+{
+  portENTER_CRITICAL(&mLock);
+  if (mPausedAtUs != 0)
+  {
+    // shift the timeline by however long we were paused
+    mStartUs += esp_timer_get_time() - mPausedAtUs;
+    mPausedAtUs = 0;
+  }
+  portEXIT_CRITICAL(&mLock);
+}
+
+int64_t PresentationClock::untilDue(int frame)
+{
+  int64_t until = 0;
+  portENTER_CRITICAL(&mLock);
+  if (hasTimeBase())
+  {
+    int64_t now = nowUs();
+    if (!mRunning)
+    {
+      mStartUs = now - ptsUs(frame);
+      mRunning = true;
+    }
+    until = mStartUs + ptsUs(frame) - now;
+  }
+  portEXIT_CRITICAL(&mLock);
+  return until;
+}
+
+bool PresentationClock::waitUntilDue(int frame)
+{
+  int64_t untilDueUs = untilDue(frame);
+  if (untilDueUs <= 0)
+  {
+    return false;
+  }
+  // sleep whole ticks only, a tick timeout can end anywhere in its last
+  // tick, so this never oversleeps. A notification already pending is still
+  // picked up when there's less than a tick to go.
+  TickType_t ticks = untilDueUs / (portTICK_PERIOD_MS * 1000);
+  if (ulTaskNotifyTake(pdTRUE, ticks) > 0)
+  {
+    return true;
+  }
+  // then spin out what's left, under a tick, rather than present early
+  untilDueUs = untilDue(frame);
+  if (untilDueUs > 0)
+  {
+    delayMicroseconds(untilDueUs);
+  }
+  return false;
+}
+
+bool PresentationClock::isExpired(int frame)
+{
+  bool expired = false;
+  portENTER_CRITICAL(&mLock);
+  if (hasTimeBase() && mRunning)
+  {
+    expired = mStartUs + ptsUs(frame + 1) <= nowUs();
+  }
+  portEXIT_CRITICAL(&mLock);
+  return expired;
+}
+
+int PresentationClock::currentFrame()
+{
+  int frame = -1;
+  portENTER_CRITICAL(&mLock);
+  if (hasTimeBase() && mRunning)
+  {
+    int64_t elapsed = nowUs() - mStartUs;
+    frame = elapsed > 0 ? elapsed * mRate / ((int64_t)mScale * 1000000) : 0;
+  }
+  portEXIT_CRITICAL(&mLock);
+  return frame;
+}
+
+void PresentationClock::framePresented(int frame)
+{
+  portENTER_CRITICAL(&mLock);
+  mStats.presentedFrames++;
+  if (hasTimeBase() && mRunning)
+  {
+    int64_t error = nowUs() - (mStartUs + ptsUs(frame));
+    if (error > LATE_TOLERANCE_US)
+    {
+      mStats.lateFrames++;
+      Metrics::count(Counter::FRAMES_LATE);
+    }
+    // RFC 3550 style smoothing
+    int32_t absError = error < 0 ? -error : error;
+    int32_t jitter = mStats.jitterUs;
+    mStats.jitterUs = jitter + (absError - jitter) / 16;
+  }
+  portEXIT_CRITICAL(&mLock);
+}
+
+void PresentationClock::framesDropped(int count)
+{
+  portENTER_CRITICAL(&mLock);
+  mStats.droppedFrames += count;
+  portEXIT_CRITICAL(&mLock);
+  Metrics::count(Counter::FRAMES_DROPPED, count);
+}
+
+PresentationClockStats PresentationClock::getStats()
+{
+  portENTER_CRITICAL(&mLock);
+  PresentationClockStats stats = mStats;
+  portEXIT_CRITICAL(&mLock);
+  return stats;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <Arduino.h>
+
+typedef struct
+{
+  uint32_t presentedFrames;
+  // frames handed to the decoder more than a tick after they were due
+  uint32_t lateFrames;
+  // frames skipped, either unread or read but not decoded
+  uint32_t droppedFrames;
+  // smoothed absolute difference between due and actual presentation time
+  uint32_t jitterUs;
+} PresentationClockStats;
+
+// Maps frame numbers to presentation times derived from the stream's
+// dwRate / dwScale, measured in esp_timer microseconds. The clock starts with
+// the first frame presented after a reset and stops while paused. Safe to use
+// from the reader and player tasks at the same time.
+class PresentationClock
+{
+private:
+  portMUX_TYPE mLock = portMUX_INITIALIZER_UNLOCKED;
+  unsigned int mRate = 0;
+  unsigned int mScale = 0;
+  bool mRunning = false;
+  // when frame 0 is (or would have been) due
+  int64_t mStartUs = 0;
+  // when the clock was paused, 0 if it isn't
+  int64_t mPausedAtUs = 0;
+  PresentationClockStats mStats = {};
+
+  int64_t ptsUs(int frame);
+  int64_t nowUs();
+
+public:
+  // Set the stream time base, restarting the clock
+  void setTimeBase(unsigned int rate, unsigned int scale);
+  // Restart the clock with the next frame presented
+  void reset();
+  void pause();
+  void resume();
+  bool hasTimeBase() { return mRate > 0 && mScale > 0; }
+  // Time until the frame is due, negative if it is late. Starts the clock if
+  // it isn't running.
+  int64_t untilDue(int frame);
+  // Block the calling task until the frame is due, to the microsecond. Returns
+  // true, early, if the task was notified in the meantime.
+  bool waitUntilDue(int frame);
+  // true if the frame after this one is already due
+  bool isExpired(int frame);
+  // The frame that should be on screen now, -1 if the clock isn't running
+  int currentFrame();
+  void framePresented(int frame);
+  void framesDropped(int count);
+  PresentationClockStats getStats();
+};
@@ -0,0 +1,159 @@
+#include "RIFFReader.h"
+#include <Arduino.h>
+#include <stdlib.h>
+#include <string.h>
+
+// blocks start on a sector boundary so FATFS can read whole sectors
+#define SECTOR_SIZE 512
+
+RIFFReader::RIFFReader(size_t blockSize) : mBlockSize(blockSize) {}
+
+RIFFReader::~RIFFReader()
+{
+  close();
+  if (mBlock)
+  {
+    free(mBlock);
+  }
+}
+
+bool RIFFReader::open(const char *fileName)
+{
+  close();
+  mFile = fopen(fileName, "rb");
+  if (!mFile)
+  {
+    return false;
+  }
+  // we do our own buffering, don't let stdio split reads into small ones
+  setvbuf(mFile, NULL, _IONBF, 0);
+  if (!mBlock)
+  {
+    // prefer internal DMA capable memory so the SD driver can transfer
+    // straight into the block, fall back to PSRAM
+    mBlock = (uint8_t *)heap_caps_malloc(mBlockSize, MALLOC_CAP_DMA);
+    if (!mBlock)
+    {
+      mBlock = (uint8_t *)malloc(mBlockSize);
+    }
+    if (!mBlock)
+    {
+      Serial.printf("Failed to allocate %zu byte read buffer\n", mBlockSize);
+      fclose(mFile);
+      mFile = NULL;
+      return false;
+    }
+  }
+  mBlockStart = 0;
+  mBlockLength = 0;
+  mPosition = 0;
+  mFilePosition = 0;
+  mEof = false;
+  return true;
+}
+
+void RIFFReader::close()
+{
+  if (mFile)
+  {
+    fclose(mFile);
+    mFile = NULL;
+  }
+}
+
+size_t RIFFReader::readFile(long position, void *dest, size_t length)
+{
+  if (position != mFilePosition && fseek(mFile, position, SEEK_SET) != 0)
+  {
+    mFilePosition = -1;
+    return 0;
+  }
+  size_t bytesRead = fread(dest, 1, length, mFile);
+  mFilePosition = position + bytesRead;
+  return bytesRead;
+}
+
+bool RIFFReader::fillBlock(long position)
+{
+  long blockStart = position & ~(long)(SECTOR_SIZE - 1);
+  mBlockLength = readFile(blockStart, mBlock, mBlockSize);
+  mBlockStart = blockStart;
+  return position < mBlockStart + (long)mBlockLength;
+}
+
+size_t RIFFReader::bufferedBytes()
+{
+  if (mPosition < mBlockStart || mPosition >= mBlockStart + (long)mBlockLength)
+  {
+    return 0;
+  }
+  return mBlockStart + mBlockLength - mPosition;
+}
+
+size_t RIFFReader::read(void *dest, size_t length)
+{
+  if (!mFile)
+  {
+    return 0;
+  }
+  uint8_t *out = (uint8_t *)dest;
+  size_t done = 0;
+  while (done < length)
+  {
+    size_t available = bufferedBytes();
+    if (available > 0)
+    {
+      size_t count = length - done < available ? length - done : available;
+      memcpy(out + done, mBlock + (mPosition - mBlockStart), count);
+      mPosition += count;
+      done += count;
+      continue;
+    }
+    size_t remaining = length - done;
+    if (remaining >= mBlockSize)
+    {
+      // too big to be worth staging in the block
+      size_t count = readFile(mPosition, out + done, remaining);
+      mPosition += count;
+      done += count;
+      break;
+    }
+    if (!fillBlock(mPosition))
+    {
+      break;
+    }
+  }
+  if (done < length)
+  {
+    mEof = true;
+  }
+  return done;
+}
+
+const uint8_t *RIFFReader::view(size_t length)
+{
+  if (!mFile || length > mBlockSize - SECTOR_SIZE)
+  {
+    // the data might straddle two blocks whatever the alignment
+    return NULL;
+  }
+  if (bufferedBytes() < length && !fillBlock(mPosition))
+  {
+    mEof = true;
+    return NULL;
+  }
+  if (bufferedBytes() < length)
+  {
+    mEof = true;
+    return NULL;
+  }
+  const uint8_t *data = mBlock + (mPosition - mBlockStart);
+  mPosition += length;
+  return data;
+}
+
+void RIFFReader::seek(long position)
+{
+  mPosition = position;
+  mEof = false;
+}
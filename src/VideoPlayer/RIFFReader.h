@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Reads a file through a large sector aligned block buffer so that chunk
+// headers, padding and skipped chunks are parsed from memory instead of
+// costing a VFS call each. Seeks and skips are lazy, the file is only touched
+// when data outside the current block is read.
+class RIFFReader
+{
+private:
+  FILE *mFile = NULL;
+  uint8_t *mBlock = NULL;
+  size_t mBlockSize;
+  // file offset of mBlock[0] and number of valid bytes in the block
+  long mBlockStart = 0;
+  size_t mBlockLength = 0;
+  // logical read position, and where the underlying FILE actually is
+  long mPosition = 0;
+  long mFilePosition = 0;
+  bool mEof = false;
+
+  size_t readFile(long position, void *dest, size_t length);
+  bool fillBlock(long position);
+  size_t bufferedBytes();
+
+public:
+  RIFFReader(size_t blockSize = 32 * 1024);
+  ~RIFFReader();
+  bool open(const char *fileName);
+  void close();
+  bool isOpen() { return mFile != NULL; }
+  // Copy the next length bytes, returns the number of bytes read. Reads
+  // larger than a block go straight into dest.
+  size_t read(void *dest, size_t length);
+  // Return a pointer to the next length bytes inside the block buffer without
+  // copying them, valid until the next call to the reader. Returns NULL if
+  // they can't fit in a single block.
+  const uint8_t *view(size_t length);
+  void skip(long length) { seek(mPosition + length); }
+  void seek(long position);
+  long tell() { return mPosition; }
+  // true once a read came up short
+  bool eof() { return mEof; }
+  void clearEof() { mEof = false; }
+};
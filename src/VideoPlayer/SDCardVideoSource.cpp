@@ -1,14 +1,466 @@
 #include "SDCardVideoSource.h"
+#include "../MediaCatalog.h"
 #include "../SDCard.h"
 #include "AVIParser.h"
+#include "../Metrics.h"
 #include <Arduino.h>
+#include <esp_timer.h>
+#include <algorithm>
+#include <sys/stat.h>
 
-SDCardVideoSource::SDCardVideoSource(SDCard *sdCard, const char *aviPath)
-    : mSDCard(sdCard), mAviPath(aviPath) {}
+// The MediaPlayer task decodes on core 1, so read from the card on core 0
+const int READER_TASK_CORE = 0;
+// Below the reader, so opening the next channel only gets the time the
+// reader doesn't need
+const int PREPARER_TASK_PRIORITY = 0;
+// How long getVideoFrame waits for the reader before giving up on a frame
+const int READ_AHEAD_TIMEOUT_MS = 100;
+// Frame slots on top of the read-ahead depth: one being read, the one on
+// screen and the one being decoded
+const int EXTRA_FRAME_SLOTS = 3;
+// Frames read ahead from the start of the channel that's likely to be next
+const int PREPARED_FRAMES = 2;
+// How many files played to the end are remembered, so that they're kept in
+// PSRAM if they come round again
+const int MAX_PLAYED_CLIPS = 16;
+
+SDCardVideoSource::SDCardVideoSource(SDCard *sdCard, const char *aviPath,
+                                     int readAheadDepth,
+                                     size_t residentBudget)
+    : mSDCard(sdCard), mAviPath(aviPath), mReadAheadDepth(readAheadDepth),
+      mFramePool(readAheadDepth + EXTRA_FRAME_SLOTS + PREPARED_FRAMES),
+      mResidentBudget(residentBudget)
+{
+  mParserMutex = xSemaphoreCreateMutex();
+  mReadyChunks = xQueueCreate(mReadAheadDepth, sizeof(VideoChunk));
+  mLowWatermark = mReadAheadDepth;
+}
 
 void SDCardVideoSource::start()
 {
-  // nothing to do!
+  xTaskCreatePinnedToCore(_readerTask, "AVIReader", 4096, this, 1,
+                          &mReaderTaskHandle, READER_TASK_CORE);
+  xTaskCreatePinnedToCore(_preparerTask, "AVIPreparer", 4096, this,
+                          PREPARER_TASK_PRIORITY, &mPreparerTaskHandle,
+                          READER_TASK_CORE);
+}
+
+void SDCardVideoSource::_readerTask(void *param)
+{
+  SDCardVideoSource *source = (SDCardVideoSource *)param;
+  source->readerTask();
+}
+
+void SDCardVideoSource::_preparerTask(void *param)
+{
+  SDCardVideoSource *source = (SDCardVideoSource *)param;
+  source->preparerTask();
+}
+
+void SDCardVideoSource::readerTask()
+{
+  while (true)
+  {
+    // the slot buffers are grown by the parser as needed
+    FrameHandle frame = mFramePool.acquire(0, portMAX_DELAY);
+    xSemaphoreTake(mParserMutex, portMAX_DELAY);
+    uint32_t generation = mGeneration;
+    AVIParser *parser = mCurrentChannelVideoParser;
+    VideoChunk chunk = {.frame = NULL, .frameNumber = 0,
+                        .generation = generation};
+    if (parser)
+    {
+      int64_t start = esp_timer_get_time();
+      // if we've fallen behind the clock, jump straight to the frame that's
+      // due rather than reading the ones in between
+      int dueFrame = mClock.currentFrame();
+      int nextFrame = parser->getNextFrameIndex();
+      if (dueFrame > nextFrame && parser->seekToFrame(dueFrame))
+      {
+        mClock.framesDropped(dueFrame - nextFrame);
+      }
+      Frame *slot = frame.get();
+      if (!readResidentFrame(parser, frame, chunk.frameNumber))
+      {
+        slot->length = parser->getNextChunk(&slot->data, slot->capacity);
+        chunk.frameNumber = parser->getNextFrameIndex() - 1;
+        Metrics::record(Metric::READ_US, esp_timer_get_time() - start);
+        Metrics::count(Counter::BYTES_READ, slot->length);
+        keepResident(chunk.frameNumber, slot);
+      }
+      if (slot->length > 0)
+      {
+        chunk.frame = frame.detach();
+      }
+      else
+      {
+        playedToEnd();
+      }
+    }
+    xSemaphoreGive(mParserMutex);
+    frame.reset();
+    // once the read-ahead is full, or there's nothing left to read, the card
+    // is free to get the next channel ready
+    if (parser && mPreparedGeneration != generation &&
+        (chunk.frame == NULL || uxQueueSpacesAvailable(mReadyChunks) == 0))
+    {
+      xTaskNotifyGive(mPreparerTaskHandle);
+    }
+    if (parser)
+    {
+      xQueueSend(mReadyChunks, &chunk, portMAX_DELAY);
+    }
+    if (!parser || chunk.frame == NULL)
+    {
+      // nothing more to read until setChannel gives us a new file
+      while (generation == mGeneration)
+      {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      }
+    }
+  }
+}
+
+void SDCardVideoSource::preparerTask()
+{
+  while (true)
+  {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    // setChannel changes both together
+    xSemaphoreTake(mParserMutex, portMAX_DELAY);
+    uint32_t generation = mGeneration;
+    int channel = mChannelNumber;
+    xSemaphoreGive(mParserMutex);
+    if (mPreparedGeneration != generation)
+    {
+      mPreparedGeneration = generation;
+      prepareChannel(generation, channel);
+    }
+  }
+}
+
+// Open the channel after the current one, which is where the end of a file,
+// a double click and going back to videos after the last image all go, and
+// read its first frames. Runs on the preparer without holding mParserMutex,
+// so it's thrown away if the channel changed in the meantime.
+void SDCardVideoSource::prepareChannel(uint32_t generation, int playing)
+{
+  if (mAviFiles.empty())
+  {
+    return;
+  }
+  int channel = (playing + 1) % mAviFiles.size();
+  std::string fileName = mCatalog->getPath(mAviFiles[channel]);
+  AVIParser *parser = new AVIParser(fileName, AVIChunkType::VIDEO);
+  if (!parser->open())
+  {
+    delete parser;
+    return;
+  }
+  ClipKey key;
+  getClipKey(fileName, key);
+  xSemaphoreTake(mParserMutex, portMAX_DELAY);
+  ResidentClip *clip = findResidentClip(key);
+  bool resident = clip && clip->missingFrames == 0;
+  xSemaphoreGive(mParserMutex);
+  std::vector<VideoChunk> chunks;
+  // a clip that's all in PSRAM starts instantly anyway
+  while (!resident && chunks.size() < PREPARED_FRAMES)
+  {
+    // don't wait for a slot, the player may need them all
+    FrameHandle frame = mFramePool.acquire(0, 0);
+    if (!frame)
+    {
+      break;
+    }
+    Frame *slot = frame.get();
+    slot->length = parser->getNextChunk(&slot->data, slot->capacity);
+    Metrics::count(Counter::BYTES_READ, slot->length);
+    if (slot->length == 0)
+    {
+      break;
+    }
+    chunks.push_back({.frame = frame.detach(),
+                      .frameNumber = parser->getNextFrameIndex() - 1,
+                      .generation = 0});
+  }
+  xSemaphoreTake(mParserMutex, portMAX_DELAY);
+  bool current = generation == mGeneration && mPreparedParser == NULL;
+  if (current)
+  {
+    mPreparedParser = parser;
+    mPreparedChannel = channel;
+    mPreparedChunks.swap(chunks);
+  }
+  xSemaphoreGive(mParserMutex);
+  if (!current)
+  {
+    for (VideoChunk &chunk : chunks)
+    {
+      FrameHandle stale(chunk.frame);
+    }
+    delete parser;
+  }
+}
+
+// Must be called with mParserMutex held
+void SDCardVideoSource::discardPreparedChannel()
+{
+  for (VideoChunk &chunk : mPreparedChunks)
+  {
+    FrameHandle stale(chunk.frame);
+  }
+  mPreparedChunks.clear();
+  delete mPreparedParser;
+  mPreparedParser = NULL;
+  mPreparedChannel = -1;
+}
+
+// Must be called with mParserMutex held
+bool SDCardVideoSource::readResidentFrame(AVIParser *parser,
+                                          FrameHandle &frame,
+                                          int &frameNumber)
+{
+  ResidentClip *clip = mResidentClip;
+  if (!clip)
+  {
+    return false;
+  }
+  // skip empty frames, as the parser would
+  int frameCount = clip->offsets.size() - 1;
+  int next = parser->getNextFrameIndex();
+  while (next < frameCount && clip->offsets[next + 1] == clip->offsets[next])
+  {
+    next++;
+  }
+  if (next >= frameCount || !clip->loaded[next])
+  {
+    return false;
+  }
+  mFramePool.borrow(frame, clip->data + clip->offsets[next],
+                    clip->offsets[next + 1] - clip->offsets[next]);
+  parser->seekToFrame(next + 1);
+  frameNumber = next;
+  Metrics::count(Counter::FRAMES_RESIDENT);
+  return true;
+}
+
+// Must be called with mParserMutex held
+void SDCardVideoSource::keepResident(int frameNumber, Frame *slot)
+{
+  ResidentClip *clip = mResidentClip;
+  if (!clip || slot->length == 0 || frameNumber < 0 ||
+      frameNumber >= (int)clip->offsets.size() - 1 || clip->loaded[frameNumber])
+  {
+    return;
+  }
+  uint32_t offset = clip->offsets[frameNumber];
+  if (slot->length != clip->offsets[frameNumber + 1] - offset)
+  {
+    return;
+  }
+  memcpy(clip->data + offset, slot->data, slot->length);
+  clip->loaded[frameNumber] = true;
+  if (--clip->missingFrames == 0)
+  {
+    Serial.printf("%s is now played from PSRAM\n",
+                  clip->key.fileName.c_str());
+  }
+}
+
+bool SDCardVideoSource::getClipKey(const std::string &fileName, ClipKey &key)
+{
+  struct stat fileStat;
+  if (stat(fileName.c_str(), &fileStat) != 0)
+  {
+    key.fileName.clear();
+    return false;
+  }
+  key.fileName = fileName;
+  key.fileSize = fileStat.st_size;
+  key.fileTime = fileStat.st_mtime;
+  return true;
+}
+
+bool SDCardVideoSource::isSameClip(const ClipKey &a, const ClipKey &b)
+{
+  return !a.fileName.empty() && a.fileName == b.fileName &&
+         a.fileSize == b.fileSize && a.fileTime == b.fileTime;
+}
+
+// Must be called with mParserMutex held
+ResidentClip *SDCardVideoSource::findResidentClip(const ClipKey &key)
+{
+  for (ResidentClip *clip : mResidentClips)
+  {
+    if (isSameClip(clip->key, key))
+    {
+      return clip;
+    }
+  }
+  return NULL;
+}
+
+// Must be called with mParserMutex held
+void SDCardVideoSource::playedToEnd()
+{
+  if (mResidentClip || mChannelClip.fileName.empty())
+  {
+    return;
+  }
+  for (auto it = mPlayedClips.begin(); it != mPlayedClips.end(); ++it)
+  {
+    if (isSameClip(*it, mChannelClip))
+    {
+      mPlayedClips.erase(it);
+      break;
+    }
+  }
+  mPlayedClips.push_back(mChannelClip);
+  if (mPlayedClips.size() > MAX_PLAYED_CLIPS)
+  {
+    mPlayedClips.erase(mPlayedClips.begin());
+  }
+}
+
+// Free the least recently played clips until size more bytes fit in the
+// budget. Clips that frames still being shown or decoded point into are
+// left alone.
+// Must be called with mParserMutex held
+bool SDCardVideoSource::evictResidentClips(size_t size)
+{
+  auto it = mResidentClips.begin();
+  while (mResidentUsed + size > mResidentBudget && it != mResidentClips.end())
+  {
+    ResidentClip *clip = *it;
+    if (clip == mResidentClip || mFramePool.isBorrowing(clip->data, clip->size))
+    {
+      ++it;
+      continue;
+    }
+    Serial.printf("Freeing %s from PSRAM, %zu bytes\n",
+                  clip->key.fileName.c_str(), clip->size);
+    free(clip->data);
+    mResidentUsed -= clip->size;
+    delete clip;
+    it = mResidentClips.erase(it);
+  }
+  return mResidentUsed + size <= mResidentBudget;
+}
+
+// Must be called with mParserMutex held
+ResidentClip *SDCardVideoSource::getResidentClip(AVIParser *parser)
+{
+  ResidentClip *clip = findResidentClip(mChannelClip);
+  if (clip)
+  {
+    // keep it away from the front of the eviction order
+    mResidentClips.erase(
+        std::find(mResidentClips.begin(), mResidentClips.end(), clip));
+    mResidentClips.push_back(clip);
+    return clip;
+  }
+  // a clip that's only played once isn't worth the PSRAM, wait until it
+  // comes round again unless it's all there is to play
+  bool looped = mAviFiles.size() == 1;
+  for (const ClipKey &played : mPlayedClips)
+  {
+    looped = looped || isSameClip(played, mChannelClip);
+  }
+  if (!looped)
+  {
+    return NULL;
+  }
+  // the size is only known up front once the file has an index
+  int frameCount = parser->getFrameCount();
+  if (frameCount == 0)
+  {
+    return NULL;
+  }
+  std::vector<uint32_t> offsets(frameCount + 1);
+  size_t size = 0;
+  int missingFrames = 0;
+  for (int i = 0; i < frameCount; i++)
+  {
+    offsets[i] = size;
+    size_t frameSize = parser->getFrameSize(i);
+    size += frameSize;
+    if (frameSize > 0)
+    {
+      missingFrames++;
+    }
+  }
+  offsets[frameCount] = size;
+  if (size == 0 || size > mResidentBudget || !evictResidentClips(size))
+  {
+    return NULL;
+  }
+  uint8_t *data = (uint8_t *)ps_malloc(size);
+  if (!data)
+  {
+    Serial.printf("No PSRAM to keep %s, %zu bytes\n",
+                  mChannelClip.fileName.c_str(), size);
+    return NULL;
+  }
+  clip = new ResidentClip();
+  clip->key = mChannelClip;
+  clip->size = size;
+  clip->data = data;
+  clip->offsets = std::move(offsets);
+  clip->loaded.resize(frameCount, false);
+  clip->missingFrames = missingFrames;
+  mResidentClips.push_back(clip);
+  mResidentUsed += size;
+  Serial.printf("Keeping %s in PSRAM, %zu bytes\n",
+                mChannelClip.fileName.c_str(), size);
+  return clip;
+}
+
+// Must be called with mParserMutex held
+void SDCardVideoSource::flushReadAhead()
+{
+  mGeneration++;
+  VideoChunk chunk;
+  while (xQueueReceive(mReadyChunks, &chunk, 0) == pdTRUE)
+  {
+    FrameHandle stale(chunk.frame);
+  }
+  mLowWatermark = mReadAheadDepth;
+  mDueFrame.reset();
+  if (mReaderTaskHandle)
+  {
+    xTaskNotifyGive(mReaderTaskHandle);
+  }
+}
+
+void SDCardVideoSource::setState(MediaPlayerState state)
+{
+  MediaPlayerState oldState = mState;
+  VideoSource::setState(state);
+  if (state == MediaPlayerState::PAUSED)
+  {
+    mClock.pause();
+  }
+  else if (state == MediaPlayerState::PLAYING &&
+           oldState == MediaPlayerState::PAUSED)
+  {
+    mClock.resume();
+  }
+  else
+  {
+    mClock.reset();
+    mDueFrame.reset();
+  }
+}
+
+ReadAheadStats SDCardVideoSource::getReadAheadStats()
+{
+  ReadAheadStats stats;
+  stats.depth = mReadAheadDepth;
+  stats.filled = uxQueueMessagesWaiting(mReadyChunks);
+  stats.lowWatermark = mLowWatermark;
+  stats.underruns = mUnderruns;
+  return stats;
 }
 
 bool SDCardVideoSource::fetchVideoData()
@@ -20,7 +472,8 @@ bool SDCardVideoSource::fetchVideoData()
     return false;
   }
   // get the list of AVI files
-  mAviFiles = mSDCard->listFiles(mAviPath, ".avi");
+  mCatalog = mSDCard->getCatalog();
+  mAviFiles = mCatalog->find(MediaFileType::VIDEO, mAviPath);
   if (mAviFiles.size() == 0)
   {
     Serial.println("No AVI files found");
@@ -43,6 +496,14 @@ void SDCardVideoSource::setChannel(int channel)
     Serial.printf("Invalid channel %d\n", channel);
     return;
   }
+  std::string aviFilename = mCatalog->getPath(mAviFiles[channel]);
+  // clips kept in PSRAM are matched on more than the name, but look the file
+  // up before blocking the reader
+  ClipKey clipKey;
+  getClipKey(aviFilename, clipKey);
+  // stop the reader using the old file
+  xSemaphoreTake(mParserMutex, portMAX_DELAY);
+  flushReadAhead();
   // close any open AVI files
   // if (mCurrentChannelAudioParser)
   // {
@@ -54,26 +515,50 @@ void SDCardVideoSource::setChannel(int channel)
     delete mCurrentChannelVideoParser;
     mCurrentChannelVideoParser = NULL;
   }
-  // open the AVI file
-  std::string aviFilename = mAviFiles[channel];
-  Serial.printf("Opening AVI file %s\n", aviFilename.c_str());
-  // mCurrentChannelAudioParser = new AVIParser(aviFilename,
-  // AVIChunkType::AUDIO); if (!mCurrentChannelAudioParser->open())
-  // {
-  //     Serial.printf("Failed to open AVI file %s\n", aviFilename.c_str());
-  //     delete mCurrentChannelAudioParser;
-  //     mCurrentChannelAudioParser = NULL;
-  // }
-  mCurrentChannelVideoParser = new AVIParser(aviFilename, AVIChunkType::VIDEO);
-  if (!mCurrentChannelVideoParser->open())
+  mResidentClip = NULL;
+  mChannelClip = clipKey;
+  mZapStartUs = esp_timer_get_time();
+  if (mPreparedParser && mPreparedChannel == channel)
   {
-    Serial.printf("Failed to open AVI file %s\n", aviFilename.c_str());
-    delete mCurrentChannelVideoParser;
-    mCurrentChannelVideoParser = NULL;
-    // delete mCurrentChannelAudioParser;
-    // mCurrentChannelAudioParser = NULL;
+    // opened in the background already, queue the frames read from it
+    Serial.printf("Switching to prepared AVI file %s\n", aviFilename.c_str());
+    mCurrentChannelVideoParser = mPreparedParser;
+    mPreparedParser = NULL;
+    for (VideoChunk &chunk : mPreparedChunks)
+    {
+      chunk.generation = mGeneration;
+      if (xQueueSend(mReadyChunks, &chunk, 0) != pdTRUE)
+      {
+        FrameHandle dropped(chunk.frame);
+      }
+    }
+    mPreparedChunks.clear();
+  }
+  else
+  {
+    discardPreparedChannel();
+    // open the AVI file
+    Serial.printf("Opening AVI file %s\n", aviFilename.c_str());
+    mCurrentChannelVideoParser =
+        new AVIParser(aviFilename, AVIChunkType::VIDEO);
+    if (!mCurrentChannelVideoParser->open())
+    {
+      Serial.printf("Failed to open AVI file %s\n", aviFilename.c_str());
+      delete mCurrentChannelVideoParser;
+      mCurrentChannelVideoParser = NULL;
+      // the card may have changed in a way the catalog couldn't tell
+      mCatalog->invalidate();
+    }
+  }
+  mPreparedChannel = -1;
+  if (mCurrentChannelVideoParser)
+  {
+    mClock.setTimeBase(mCurrentChannelVideoParser->getRate(),
+                       mCurrentChannelVideoParser->getScale());
+    mResidentClip = getResidentClip(mCurrentChannelVideoParser);
   }
   mChannelNumber = channel;
+  xSemaphoreGive(mParserMutex);
 }
 
 void SDCardVideoSource::nextChannel()
@@ -87,46 +572,93 @@ void SDCardVideoSource::nextChannel()
   setChannel(channel);
 }
 
-bool SDCardVideoSource::getVideoFrame(uint8_t **buffer, size_t &bufferLength,
-                                      size_t &frameLength)
+FrameHandle SDCardVideoSource::getVideoFrame()
 {
   if (!mCurrentChannelVideoParser)
   {
-    return false;
+    return FrameHandle();
   }
-  if (mState == MediaPlayerState::STOPPED ||
-      mState == MediaPlayerState::STATIC)
+  if (mState != MediaPlayerState::PLAYING)
   {
-    vTaskDelay(100 / portTICK_PERIOD_MS);
-    return false;
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+    return FrameHandle();
   }
-  if (mState == MediaPlayerState::PAUSED)
+  VideoChunk chunk;
+  FrameHandle frame;
+  if (mDueFrame)
   {
-    vTaskDelay(100 / portTICK_PERIOD_MS);
-    return false;
+    // still waiting for this one
+    frame = std::move(mDueFrame);
+    chunk.frameNumber = mDueFrameNumber;
   }
-  // how long should we wait before fetching the next frame?
-  float frameRate = mCurrentChannelVideoParser->getFrameRate();
-  if (frameRate > 0)
+  else
   {
-    float frameTime = 1000.0f / frameRate;
-    long delay = frameTime - (millis() - mLastFrameTime);
-    if (delay > 0)
+    int filled = uxQueueMessagesWaiting(mReadyChunks);
+    Metrics::record(Metric::READ_AHEAD_FILL, filled);
+    if (filled == 0)
+    {
+      mUnderruns++;
+    }
+    if (filled < mLowWatermark)
+    {
+      mLowWatermark = filled;
+    }
+    bool switched = false;
+    while (true)
     {
-      vTaskDelay(delay / portTICK_PERIOD_MS);
+      if (xQueueReceive(mReadyChunks, &chunk,
+                        pdMS_TO_TICKS(READ_AHEAD_TIMEOUT_MS)) != pdTRUE)
+      {
+        return FrameHandle();
+      }
+      // take over the reference the reader passed through the queue
+      frame = FrameHandle(chunk.frame);
+      if (chunk.generation != mGeneration)
+      {
+        // read from a previous channel
+        continue;
+      }
+      if (!frame && !switched)
+      {
+        // end of video, move to the next one. If it was prepared its first
+        // frame is already queued, so it follows on without a gap.
+        nextChannel();
+        switched = true;
+        continue;
+      }
+      if (frame && mClock.isExpired(chunk.frameNumber) &&
+          uxQueueMessagesWaiting(mReadyChunks) > 0)
+      {
+        // the next frame is already due, don't waste time decoding this one
+        mClock.framesDropped(1);
+        continue;
+      }
+      break;
+    }
+    if (!frame)
+    {
+      // end of video, move to next one
+      nextChannel();
+      return FrameHandle();
     }
   }
-  mLastFrameTime = millis();
-  frameLength = mCurrentChannelVideoParser->getNextChunk((uint8_t **)buffer,
-                                                         bufferLength);
-  if (frameLength == 0)
+  // wait until the frame is due. The deadline is absolute so it doesn't
+  // drift.
+  if (mClock.waitUntilDue(chunk.frameNumber))
   {
-    // end of video, move to next one
-    nextChannel();
-    return false;
+    // the player has a command to see to, keep the frame for next time
+    mDueFrame = std::move(frame);
+    mDueFrameNumber = chunk.frameNumber;
+    return FrameHandle();
   }
+  mClock.framePresented(chunk.frameNumber);
   mFrameCount++;
-  return true;
+  if (mZapStartUs != 0)
+  {
+    Metrics::record(Metric::ZAP_US, esp_timer_get_time() - mZapStartUs);
+    mZapStartUs = 0;
+  }
+  return frame;
 }
 
 std::string SDCardVideoSource::getChannelName()
@@ -134,13 +666,7 @@ std::string SDCardVideoSource::getChannelName()
   if (mChannelNumber >= 0 && mChannelNumber < mAviFiles.size())
   {
     // we just want the filename, not the full path
-    std::string fullPath = mAviFiles[mChannelNumber];
-    size_t lastSlash = fullPath.find_last_of('/');
-    if (lastSlash != std::string::npos)
-    {
-      return fullPath.substr(lastSlash + 1);
-    }
-    return fullPath;
+    return mCatalog->getName(mAviFiles[mChannelNumber]);
   }
   return "Unknown";
 }
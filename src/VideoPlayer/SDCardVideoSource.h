@@ -1,28 +1,132 @@
 
 #pragma once
 
+#include "PresentationClock.h"
 #include "VideoSource.h"
 #include <string>
 #include <vector>
 
 class SDCard;
 class AVIParser;
+class MediaCatalog;
+
+// A chunk read ahead of playback by the reader task
+typedef struct
+{
+  // holds a reference to the pooled frame, NULL marks the end of the channel
+  Frame *frame;
+  // frame number in the stream, used to schedule the chunk
+  int frameNumber;
+  uint32_t generation;
+} VideoChunk;
+
+typedef struct
+{
+  int depth;
+  int filled;
+  // lowest fill level seen since the channel started
+  int lowWatermark;
+  uint32_t underruns;
+} ReadAheadStats;
+
+// Tells a file apart from one copied over it with the same name, as the
+// .tti index cache does
+typedef struct
+{
+  std::string fileName;
+  uint32_t fileSize;
+  uint32_t fileTime;
+} ClipKey;
+
+// A clip kept in PSRAM so loops of it don't go back to the card. Its frames
+// are packed in index order and copied in as they're first read.
+typedef struct
+{
+  ClipKey key;
+  size_t size;
+  uint8_t *data;
+  // frame n is at data + offsets[n] and ends at offsets[n + 1]
+  std::vector<uint32_t> offsets;
+  std::vector<bool> loaded;
+  // non empty frames still to be read from the card
+  int missingFrames;
+} ResidentClip;
 
 class SDCardVideoSource : public VideoSource
 {
 private:
-  std::vector<std::string> mAviFiles;
+  // catalog indexes of the videos, one per channel
+  std::vector<int> mAviFiles;
   // AVIParser *mCurrentChannelAudioParser = NULL;
   AVIParser *mCurrentChannelVideoParser = NULL;
   SDCard *mSDCard;
+  MediaCatalog *mCatalog = NULL;
   const char *mAviPath;
   int mFrameCount = 0;
   int mCurrentWsFrameLength = 0;
-  unsigned long mLastFrameTime = 0;
   volatile bool mWrapped = false;
 
+  // read-ahead ring, the reader fills pool slots and queues them as chunks
+  int mReadAheadDepth;
+  FramePool mFramePool;
+  QueueHandle_t mReadyChunks = NULL;
+  SemaphoreHandle_t mParserMutex = NULL;
+  TaskHandle_t mReaderTaskHandle = NULL;
+  // bumped by setChannel so chunks read from the previous file are dropped
+  volatile uint32_t mGeneration = 0;
+  volatile int mLowWatermark = 0;
+  volatile uint32_t mUnderruns = 0;
+  PresentationClock mClock;
+  // a frame that wasn't due yet when the wait for it was cut short
+  FrameHandle mDueFrame;
+  int mDueFrameNumber = 0;
+
+  // clips are only given PSRAM once they loop, or straight away if there's
+  // just the one channel. The least recently played ones are freed to make
+  // room once no frames handed out point into them.
+  size_t mResidentBudget;
+  size_t mResidentUsed = 0;
+  // least recently played first
+  std::vector<ResidentClip *> mResidentClips;
+  // the current channel's clip, NULL if it's read from the card
+  ResidentClip *mResidentClip = NULL;
+  // the current channel's file, and the files that have been played to the
+  // end, least recently first
+  ClipKey mChannelClip;
+  std::vector<ClipKey> mPlayedClips;
+
+  // the channel likely to be set next, opened by the preparer task while the
+  // reader had nothing else to do, with its first frames already read
+  TaskHandle_t mPreparerTaskHandle = NULL;
+  AVIParser *mPreparedParser = NULL;
+  int mPreparedChannel = -1;
+  std::vector<VideoChunk> mPreparedChunks;
+  // the generation the preparer last prepared a channel for
+  volatile uint32_t mPreparedGeneration = UINT32_MAX;
+  // when the channel was set, 0 once its first frame has been handed over
+  int64_t mZapStartUs = 0;
+
+  static void _readerTask(void *param);
+  void readerTask();
+  static void _preparerTask(void *param);
+  void preparerTask();
+  void flushReadAhead();
+  void prepareChannel(uint32_t generation, int playing);
+  void discardPreparedChannel();
+  static bool getClipKey(const std::string &fileName, ClipKey &key);
+  static bool isSameClip(const ClipKey &a, const ClipKey &b);
+  ResidentClip *findResidentClip(const ClipKey &key);
+  ResidentClip *getResidentClip(AVIParser *parser);
+  bool evictResidentClips(size_t size);
+  void playedToEnd();
+  bool readResidentFrame(AVIParser *parser, FrameHandle &frame,
+                         int &frameNumber);
+  void keepResident(int frameNumber, Frame *slot);
+
 public:
-  SDCardVideoSource(SDCard *sdCard, const char *aviPath);
+  SDCardVideoSource(SDCard *sdCard, const char *aviPath,
+                    int readAheadDepth = 4,
+                    size_t residentBudget = 3 * 1024 * 1024);
   void start();
   bool fetchVideoData();
   int getChannelCount() { return mAviFiles.size(); };
@@ -32,11 +136,13 @@ public:
   //     return mCurrentChannelAudioParser;
   // };
   // see superclass for documentation
-  bool getVideoFrame(uint8_t **buffer, size_t &bufferLength,
-                     size_t &frameLength);
+  FrameHandle getVideoFrame();
   void setChannel(int channel);
   void nextChannel();
-  bool consumeWrapped()
+  void setState(MediaPlayerState state) override;
+  ReadAheadStats getReadAheadStats();
+  PresentationClockStats getClockStats() { return mClock.getStats(); }
+  bool consumeWrapped() override
   {
     bool wrapped = mWrapped;
     mWrapped = false;
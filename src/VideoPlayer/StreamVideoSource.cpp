@@ -1,10 +1,18 @@
 #include "StreamVideoSource.h"
+#include "../Metrics.h"
+#include "../Trace.h"
 #include <Arduino.h>
 #include <ESPAsyncWebServer.h>
 
 const int MIN_FRAME_INTERVAL_MS = 1000 / 30; // approx 30fps
-
-StreamVideoSource::StreamVideoSource(AsyncWebServer *server) : mServer(server)
+// Frame slots: one being received, one ready, the one on screen and the one
+// being decoded
+const int STREAM_FRAME_SLOTS = 4;
+// How long getVideoFrame waits for a frame before letting the player go on
+const int FRAME_WAIT_MS = 100;
+
+StreamVideoSource::StreamVideoSource(AsyncWebServer *server)
+    : mServer(server), mFramePool(STREAM_FRAME_SLOTS)
 {
   mWebSocket = new AsyncWebSocket("/ws");
   mServer->addHandler(mWebSocket);
@@ -16,62 +24,40 @@ StreamVideoSource::StreamVideoSource(AsyncWebServer *server) : mServer(server)
 
 void StreamVideoSource::start()
 {
-  // create a mutex to control access to the JPEG buffer
-  mCurrentFrameMutex = xSemaphoreCreateMutex();
-  streamingSemaphore = xSemaphoreCreateMutex();
-  jpegQueue = xQueueCreate(10, sizeof(JpegData_t));
 }
 
-bool StreamVideoSource::getVideoFrame(uint8_t **buffer, size_t &bufferLength, size_t &frameLength)
+FrameHandle StreamVideoSource::getVideoFrame()
 {
   if (mStreamState != StreamState::STREAMING)
   {
-    return false;
+    return FrameHandle();
   }
 
-  bool copiedFrame = false;
-  // lock the image buffer
-  xSemaphoreTake(mCurrentFrameMutex, portMAX_DELAY);
-  // if the frame is ready, copy it to the buffer
-  JpegData_t receivedJpeg;
-  if (xQueueReceive(jpegQueue, &receivedJpeg, portMAX_DELAY) == pdPASS)
+  mConsumerTask = xTaskGetCurrentTaskHandle();
+  FrameHandle frame = mReadyFrame.take();
+  if (!frame)
+  {
+    // woken early by a new frame or by a command for the player
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(FRAME_WAIT_MS));
+    frame = mReadyFrame.take();
+  }
+  if (frame)
   {
-    copiedFrame = true;
-    // reallocate the image buffer if necessary
-    if (receivedJpeg.jpeg_len > bufferLength)
-    {
-      *buffer = (uint8_t *)realloc(*buffer, receivedJpeg.jpeg_len);
-      bufferLength = receivedJpeg.jpeg_len;
-    }
-    // copy the image buffer
-    memcpy(*buffer, receivedJpeg.jpeg_data, receivedJpeg.jpeg_len);
-    frameLength = receivedJpeg.jpeg_len;
-    // free the memory that was allocated in the websocket handler
-    free(receivedJpeg.jpeg_data);
-
     // Send "ready"
     uint32_t now = millis();
-    if (now - mLastReadyTime > MIN_FRAME_INTERVAL_MS)
+    if (now - mLastReadyTime > MIN_FRAME_INTERVAL_MS &&
+        mStreamState == StreamState::STREAMING)
     {
-      if (xSemaphoreTake(streamingSemaphore, portMAX_DELAY) == pdTRUE)
-      {
-        if (mStreamState == StreamState::STREAMING)
-        {
-          mWebSocket->textAll("ready");
-          mLastReadyTime = now;
-        }
-        xSemaphoreGive(streamingSemaphore);
-      }
+      mWebSocket->textAll("ready");
+      mLastReadyTime = now;
     }
   }
-  // unlock the image buffer
-  xSemaphoreGive(mCurrentFrameMutex);
-  // return true if we copied a frame, false otherwise
-  return copiedFrame;
+  return frame;
 }
 
 void StreamVideoSource::onWsEvent(AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len)
 {
+  TRACE_SCOPE("ws ingest");
   if (type == WS_EVT_CONNECT)
   {
     mStreamState = StreamState::CONNECTED;
@@ -79,7 +65,8 @@ void StreamVideoSource::onWsEvent(AsyncWebSocket *server, AsyncWebSocketClient *
   else if (type == WS_EVT_DISCONNECT)
   {
     mStreamState = StreamState::DISCONNECTED;
-    mJpegBuffer.clear(); // Clear buffer on disconnect
+    mReadyFrame.clear();
+    mIncomingFrame.reset(); // Drop the partial frame on disconnect
   }
   else if (type == WS_EVT_DATA)
   {
@@ -90,36 +77,18 @@ void StreamVideoSource::onWsEvent(AsyncWebSocket *server, AsyncWebSocketClient *
       {
         Serial.println("Received START command");
 
-        if (xSemaphoreTake(streamingSemaphore, portMAX_DELAY) == pdTRUE)
-        {
-          mStreamState = StreamState::STREAMING;
-          xSemaphoreGive(streamingSemaphore);
-          mWebSocket->textAll("ready");
-        }
+        mStreamState = StreamState::STREAMING;
+        mWebSocket->textAll("ready");
       }
       else if (len == 4 && strncmp((char *)data, "STOP", 4) == 0)
       {
         Serial.println("Received STOP command");
 
-        if (xSemaphoreTake(streamingSemaphore, portMAX_DELAY) == pdTRUE)
-        {
-          mStreamState = StreamState::CONNECTED;
-          xSemaphoreGive(streamingSemaphore);
-
-          // Attendre un petit moment pour que la dernière transaction se termine
-          vTaskDelay(pdMS_TO_TICKS(100));
-
-          // Vider la queue de manière sécurisée
-          JpegData_t dummyData;
-          while (xQueueReceive(jpegQueue, &dummyData, 0) == pdTRUE)
-          {
-            if (dummyData.jpeg_data != NULL)
-            {
-              free(dummyData.jpeg_data);
-            }
-          }
-          mJpegBuffer.clear();
-        }
+        mStreamState = StreamState::CONNECTED;
+        // the player stops taking frames once it sees the state change, drop
+        // the one it hasn't taken
+        mReadyFrame.clear();
+        mIncomingFrame.reset();
       }
       return;
     }
@@ -130,60 +99,49 @@ void StreamVideoSource::onWsEvent(AsyncWebSocket *server, AsyncWebSocketClient *
     {
       Serial.printf("New binary message, total len: %u\n", info->len);
       mCurrentWsFrameLength = info->len;
-      mJpegBuffer.clear();
-      mJpegBuffer.reserve(info->len);
+      mIncomingLength = 0;
+      // don't wait for a slot, we're on the network task
+      mIncomingFrame = mFramePool.acquire(info->len, 0);
+      if (!mIncomingFrame)
+      {
+        Serial.println("No free frame slot, dropping frame.");
+      }
     }
 
-    // Append the current frame's data to our buffer
+    // Append the current frame's data to the slot
     // 'data' is the buffer for this frame, 'len' is its size
-    mJpegBuffer.insert(mJpegBuffer.end(), data, data + len);
-    Serial.printf("Appended %d bytes, total buffer: %d\n", len, mJpegBuffer.size());
+    if (mIncomingFrame && mIncomingLength + len <= mIncomingFrame.get()->capacity)
+    {
+      memcpy(mIncomingFrame.data() + mIncomingLength, data, len);
+    }
+    mIncomingLength += len;
+    Metrics::count(Counter::BYTES_READ, len);
+    Serial.printf("Appended %d bytes, total buffer: %d\n", len, mIncomingLength);
 
     // Check if this is the final frame
-    if (mJpegBuffer.size() >= mCurrentWsFrameLength)
+    if (mIncomingLength >= mCurrentWsFrameLength)
     {
-      Serial.printf("Final frame received. Total size: %d bytes. Decoding...\n", mJpegBuffer.size());
+      Serial.printf("Final frame received. Total size: %d bytes. Decoding...\n", mIncomingLength);
 
-      if (uxQueueSpacesAvailable(jpegQueue) > 0)
+      if (mIncomingFrame && mIncomingLength <= mIncomingFrame.get()->capacity)
       {
-        // 1. Allocate new memory for the decoder task
-        // We use malloc here because it's thread-safe and not tied to the std::vector
-        uint8_t *jpeg_copy = (uint8_t *)malloc(mJpegBuffer.size());
-
-        if (jpeg_copy != NULL)
+        mIncomingFrame.get()->length = mIncomingLength;
+        // the reference moves to the player, replacing a frame it hasn't
+        // got round to
+        if (!mReadyFrame.publish(std::move(mIncomingFrame)))
         {
-          // 2. Copy the data from the vector into the new buffer
-          memcpy(jpeg_copy, mJpegBuffer.data(), mJpegBuffer.size());
-
-          // 3. Create the struct to send
-          JpegData_t newJpeg = {.jpeg_data = jpeg_copy, .jpeg_len = mJpegBuffer.size()};
-
-          // 4. Send the struct (containing the *new* pointer) to the queue
-          if (xQueueSend(jpegQueue, &newJpeg, 0) != pdPASS)
-          {
-            // This shouldn't happen if we just checked, but it's good practice
-            Serial.println("Failed to queue frame, freeing copy.");
-            free(jpeg_copy); // Clean up if send fails
-          }
-          else
-          {
-            // Serial.println("Frame queued successfully.");
-            // Ownership is now transferred to the decoder task
-          }
+          Serial.println("Player behind, dropping frame.");
         }
-        else
+        TaskHandle_t consumer = mConsumerTask;
+        if (consumer)
         {
-          Serial.println("malloc failed! Dropping frame.");
-          // Not enough RAM to make a copy, drop the frame
+          xTaskNotifyGive(consumer);
         }
       }
-      else
-      {
-        Serial.println("Queue full, dropping frame.");
-      }
 
-      // IMPORTANT: Clear the buffer to be ready for the next image
-      mJpegBuffer.clear();
+      // IMPORTANT: Clear the slot to be ready for the next image
+      mIncomingFrame.reset();
+      mIncomingLength = 0;
       mCurrentWsFrameLength = 0;
     }
   }
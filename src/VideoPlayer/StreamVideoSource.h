@@ -10,28 +10,22 @@ enum class StreamState
   STREAMING
 };
 
-// Struct to hold JPEG data passed via the FreeRTOS queue
-typedef struct
-{
-  uint8_t *jpeg_data;
-  size_t jpeg_len;
-} JpegData_t;
-
 class StreamVideoSource : public VideoSource
 {
 private:
-  bool mFrameReady = false;
-  uint8_t *mCurrentFrameBuffer = NULL;
-  size_t mCurrentFrameLength = 0;
-  size_t mCurrentFrameBufferLength = 0;
   AsyncWebServer *mServer = NULL;
   AsyncWebSocket *mWebSocket = NULL;
-  SemaphoreHandle_t mCurrentFrameMutex = NULL;
-  StreamState mStreamState = StreamState::DISCONNECTED;
-  std::vector<uint8_t> mJpegBuffer;
+  // only changed from the network task
+  volatile StreamState mStreamState = StreamState::DISCONNECTED;
+  // websocket frames are assembled straight into a pool slot
+  FramePool mFramePool;
+  FrameHandle mIncomingFrame;
+  size_t mIncomingLength = 0;
   void onWsEvent(AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len);
-  SemaphoreHandle_t streamingSemaphore = NULL;
-  QueueHandle_t jpegQueue = NULL;
+  // the newest complete frame, passed from the network task to the player
+  FrameSlot mReadyFrame;
+  // the task waiting in getVideoFrame, notified when a frame arrives
+  volatile TaskHandle_t mConsumerTask = NULL;
   size_t mCurrentWsFrameLength = 0;
   uint32_t mLastReadyTime = 0;
 
@@ -39,7 +33,7 @@ public:
   StreamVideoSource(AsyncWebServer *server);
   void start();
   // see superclass for documentation
-  bool getVideoFrame(uint8_t **buffer, size_t &bufferLength, size_t &frameLength);
+  FrameHandle getVideoFrame();
   void setChannel(int channel);
   void nextChannel();
   int getChannelCount();
@@ -3,8 +3,8 @@
 #include "Prefs.h"
 #include "VideoSource.h"
 #include "Battery.h"
+#include "../Metrics.h"
 #include <Arduino.h>
-#include <list>
 
 VideoPlayer::VideoPlayer(VideoSource *videoSource, Display &display,
                          Prefs &prefs, Battery &battery)
@@ -19,82 +19,33 @@ void VideoPlayer::start()
   MediaPlayer::start();
 }
 
-void VideoPlayer::set(int channel)
+void VideoPlayer::onSet(int channel)
 {
-  if (mTaskHandle != NULL)
-  {
-    mRunTask = false;
-    // wait for the task to stop
-    while (mTaskHandle != NULL)
-    {
-      vTaskDelay(10);
-    }
-  }
   // update the video source
   mVideoSource->setChannel(channel);
   drawOSDTimed(mVideoSource->getChannelName(), TOP_LEFT, OSDLevel::STANDARD);
-  startTask();
 }
 
-void VideoPlayer::next()
+void VideoPlayer::onNext()
 {
   if (mState == MediaPlayerState::PAUSED)
   {
-    play();
-  }
-
-  if (mTaskHandle != NULL)
-  {
-    mRunTask = false;
-    // wait for the task to stop
-    while (mTaskHandle != NULL)
-    {
-      vTaskDelay(10);
-    }
+    changeState(MediaPlayerState::PLAYING);
   }
   mVideoSource->nextChannel();
   drawOSDTimed(mVideoSource->getChannelName(), TOP_LEFT, OSDLevel::STANDARD);
-  startTask();
 }
 
 void VideoPlayer::playStatic()
 {
-  if (mState == MediaPlayerState::STATIC)
-  {
-    return;
-  }
-
-  // If a task is running, stop it cleanly
-  if (mTaskHandle != NULL)
-  {
-    mRunTask = false;
-    while (mTaskHandle != NULL)
-    {
-      vTaskDelay(10);
-    }
-  }
-
-  auto oldState = mState;
-  mState = MediaPlayerState::STATIC;
-  onStateChanged(oldState, mState);
-
-  mDisplay.fillScreen(DisplayColors::BLACK);
-
-  // Start the task in STATIC mode
-  startTask();
+  sendCommand(PlayerCommandType::STATIC);
 }
 
 void VideoPlayer::redrawFrame()
 {
   if (mCurrentFrame)
   {
-    if (mJpeg.openRAM(mCurrentFrame, mCurrentFrameSize, _doDraw))
-    {
-      mJpeg.setUserPointer(this);
-      mJpeg.setPixelType(RGB565_BIG_ENDIAN);
-      mJpeg.decode(0, 0, 0);
-      mJpeg.close();
-    }
+    decodeCurrentFrame();
     mDisplay.flushSprite();
   }
   else
@@ -103,13 +54,33 @@ void VideoPlayer::redrawFrame()
   }
 }
 
-bool VideoPlayer::getFrame(uint8_t **buffer, size_t &bufferLength, size_t &frameLength)
+FrameHandle VideoPlayer::getFrame()
 {
   if (!mVideoSource)
   {
-    return false;
+    return FrameHandle();
+  }
+  FrameHandle frame = mVideoSource->getVideoFrame();
+  int channel = mVideoSource->getChannelNumber();
+  if (channel != mFrameChannel)
+  {
+    // misses are counted per channel, so a clip too long for the frame cache
+    // doesn't stop the next one being cached, and doesn't push it out again
+    // every time it comes round
+    if (mFrameChannel >= 0)
+    {
+      if (mFrameChannel >= (int)mChannelCacheMisses.size())
+      {
+        mChannelCacheMisses.resize(mFrameChannel + 1, 0);
+      }
+      mChannelCacheMisses[mFrameChannel] = mFrameCacheMisses;
+    }
+    mFrameCacheMisses = channel >= 0 && channel < (int)mChannelCacheMisses.size()
+                            ? mChannelCacheMisses[channel]
+                            : 0;
+    mFrameChannel = channel;
   }
-  return mVideoSource->getVideoFrame(buffer, bufferLength, frameLength);
+  return frame;
 }
 
 void VideoPlayer::onStateChanged(MediaPlayerState oldState, MediaPlayerState newState)
@@ -138,7 +109,7 @@ void VideoPlayer::onStatic()
   uint16_t *staticBuffer = (uint16_t *)malloc(width * height * 2);
   for (int i = 0; i < mDisplay.height(); i++)
   {
-    if (!mRunTask)
+    if (hasPendingCommands())
     {
       break;
     }
@@ -155,24 +126,46 @@ void VideoPlayer::onStatic()
 void VideoPlayer::onFrameDisplayed()
 {
   OSDLevel osdLevel = mPrefs.getOsdLevel();
-  if (osdLevel >= OSDLevel::DEBUG)
+  if (osdLevel < OSDLevel::DEBUG)
   {
-    mFrameTimes.push_back(millis());
-    // keep the frame rate elapsed time to 5 seconds
-    while (mFrameTimes.size() > 0 &&
-           mFrameTimes.back() - mFrameTimes.front() > 5000)
-    {
-      mFrameTimes.pop_front();
-    }
+    return;
+  }
+  uint32_t now = millis();
+  if (now - mLastStatsMs >= 1000)
+  {
+    // repeated and cached frames are shown too, they just weren't decoded
+    // again
+    uint32_t frames = Metrics::getCount(Counter::FRAMES_DECODED) +
+                      Metrics::getCount(Counter::FRAMES_SKIPPED) +
+                      Metrics::getCount(Counter::FRAMES_CACHED);
+    int fps = (frames - mLastStatsFrames) * 1000 / (now - mLastStatsMs);
+    // with the share of frames skipped for being the same as the last
+    char text[32];
+    sprintf(text, "%d FPS %d%%", fps,
+            mReceivedFrames ? mDuplicateFrames * 100 / mReceivedFrames : 0);
+    mFpsText = text;
+    // 90th percentile of each stage in ms, the biggest bounds the frame rate
+    sprintf(text, "R%d D%d F%d",
+            Metrics::summarize(Metric::READ_US).p90 / 1000,
+            Metrics::summarize(Metric::DECODE_US).p90 / 1000,
+            Metrics::summarize(Metric::FLUSH_US).p90 / 1000);
+    mStagesText = text;
+    mLastStatsMs = now;
+    mLastStatsFrames = frames;
+  }
+  mDisplay.drawOSD(mFpsText.c_str(), BOTTOM_RIGHT, OSDLevel::DEBUG);
+  char batText[16];
+  sprintf(batText, "%d%% %.2f", mBattery.getBatteryLevel(),
+          mBattery.getVoltage());
+  mDisplay.drawOSD(batText, BOTTOM_LEFT, OSDLevel::DEBUG);
+  // the channel name goes in the same place when it changes
+  bool topLeftFree = true;
+  for (const auto &osd : mTimedOsds)
+  {
+    topLeftFree = topLeftFree && osd.position != TOP_LEFT;
   }
-  if (osdLevel >= OSDLevel::DEBUG)
+  if (topLeftFree)
   {
-    char fpsText[8];
-    sprintf(fpsText, "%d FPS", mFrameTimes.size() / 5);
-    mDisplay.drawOSD(fpsText, BOTTOM_RIGHT, OSDLevel::DEBUG);
-    char batText[16];
-    sprintf(batText, "%d%% %.2f", mBattery.getBatteryLevel(),
-            mBattery.getVoltage());
-    mDisplay.drawOSD(batText, BOTTOM_LEFT, OSDLevel::DEBUG);
+    mDisplay.drawOSD(mStagesText.c_str(), TOP_LEFT, OSDLevel::DEBUG);
   }
 }
\ No newline at end of file
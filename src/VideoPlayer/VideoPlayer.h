@@ -1,28 +1,36 @@
 #pragma once
 #include "VideoSource.h"
 #include "MediaPlayer.h"
-#include <list>
+#include <string>
+#include <vector>
 
 class VideoPlayer : public MediaPlayer
 {
 private:
   VideoSource *mVideoSource = NULL;
-  std::list<int> mFrameTimes;
+  // the channel of the last frame, the source moves on by itself at the end
+  // of a file, and the frame cache misses of every channel played so far
+  int mFrameChannel = -1;
+  std::vector<int> mChannelCacheMisses;
+  // the debug OSD is worked out once a second from the metrics
+  uint32_t mLastStatsMs = 0;
+  uint32_t mLastStatsFrames = 0;
+  std::string mFpsText;
+  std::string mStagesText;
 
 protected:
-  virtual bool getFrame(uint8_t **buffer, size_t &bufferLength, size_t &frameLength) override;
+  virtual FrameHandle getFrame() override;
   virtual void onFrameDisplayed() override;
   virtual void onStateChanged(MediaPlayerState oldState, MediaPlayerState newState) override;
   virtual void onStatic() override;
+  virtual void onSet(int channelIndex) override;
+  virtual void onNext() override;
 
 public:
   VideoPlayer(VideoSource *videoSource, Display &display, Prefs &prefs,
               Battery &battery);
-  virtual void set(int channelIndex) override;
   void playStatic();
   void redrawFrame();
 
-  virtual void next() override;
-
   virtual void start() override;
 };
\ No newline at end of file
@@ -15,18 +15,19 @@ protected:
 public:
   virtual void start() = 0;
   // Retrieve a JPEG image for the frame at the given time.
-  // Returns true if a frame was retrieved, false if the current frame should be
-  // re-used e.g. the elapsed time is closest to the previous frame. The buffer
-  // is re-allocated if the frame is larger than the previous frame.
-  virtual bool getVideoFrame(uint8_t **buffer, size_t &bufferLength,
-                             size_t &frameLength) = 0;
+  // Returns an empty handle if the current frame should be re-used e.g. the
+  // elapsed time is closest to the previous frame.
+  // Called from the player's worker, which is notified when it is sent a
+  // command. Waits must be timed and should end early on a notification, so
+  // the player can act on it.
+  virtual FrameHandle getVideoFrame() = 0;
   // update the audio time
   void updateAudioTime(int audioTimeMs)
   {
     mAudioTimeMs = audioTimeMs;
     mLastAudioTimeUpdateMs = millis();
   }
-  void setState(MediaPlayerState state)
+  virtual void setState(MediaPlayerState state)
   {
     mState = state;
     switch (state)
@@ -48,4 +49,6 @@ public:
   virtual int getChannelNumber() { return mChannelNumber; }
   virtual std::string getChannelName() = 0;
   virtual bool fetchVideoData() = 0;
+  // True once after playback wraps from the last channel to the first
+  virtual bool consumeWrapped() { return false; }
 };
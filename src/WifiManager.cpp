@@ -8,8 +8,9 @@
 // Simple WiFi manager for ESP32 using AsyncWebServer and Preferences
 // Inspired by https://randomnerdtutorials.com/esp32-wi-fi-manager-asyncwebserver/
 
-WifiManager::WifiManager(AsyncWebServer *server, Prefs *prefs, Battery *battery)
-    : server(server), prefs(prefs), _battery(battery), subnet(255, 255, 0, 0), previousMillis(0), _apSsid("") {}
+WifiManager::WifiManager(AsyncWebServer *server, Prefs *prefs, Battery *battery,
+                         FlashLibrary *library)
+    : server(server), prefs(prefs), _battery(battery), _library(library), subnet(255, 255, 0, 0), previousMillis(0), _apSsid("") {}
 
 void WifiManager::begin()
 {
@@ -122,11 +123,45 @@ void WifiManager::setupCommonRoutes()
     request->send(200, "application/json", "{\"status\":\"ok\"}");
 
     if (restartRequired) {
+        prefs->commit();
         delay(2000);
         ESP.restart();
     } });
   server->addHandler(handler);
 
+  // the server only runs without an SD card, the card's read stages are
+  // written to metrics.json on it instead, see Metrics::dump
+  server->on("/metrics", HTTP_GET, [](AsyncWebServerRequest *request)
+             {
+    JsonDocument json;
+    json["uptimeMs"] = millis();
+    for (int i = 0; i < (int)Metric::COUNT; i++) {
+      MetricSummary summary = Metrics::summarize((Metric)i);
+      JsonObject stage = json["stages"][Metrics::getName((Metric)i)].to<JsonObject>();
+      stage["p50"] = summary.p50;
+      stage["p90"] = summary.p90;
+      stage["p99"] = summary.p99;
+      stage["max"] = summary.max;
+      stage["samples"] = summary.samples;
+    }
+    for (int i = 0; i < (int)Counter::COUNT; i++) {
+      json["counters"][Metrics::getName((Counter)i)] = Metrics::getCount((Counter)i);
+    }
+    String response;
+    serializeJson(json, response);
+    request->send(200, "application/json", response); });
+
+  server->on("/trace", HTTP_GET, [](AsyncWebServerRequest *request)
+             {
+    if (!Trace::isEnabled()) {
+      request->send(404, "text/plain", "Tracing is off, build with -DTRACE");
+      return;
+    }
+    // the reader lives as long as the response is being sent
+    std::shared_ptr<TraceReader> reader = std::make_shared<TraceReader>();
+    request->sendChunked("application/json", [reader](uint8_t *buffer, size_t maxLen, size_t index) -> size_t
+                         { return reader->read(buffer, maxLen); }); });
+
   // OTA update endpoint
   server->on("/update", HTTP_POST, [](AsyncWebServerRequest *request) {}, [](AsyncWebServerRequest *request, String filename, size_t index, uint8_t *data, size_t len, bool final)
              {
@@ -150,11 +185,53 @@ void WifiManager::setupCommonRoutes()
       AsyncWebServerResponse *response = request->beginResponse(200, "text/plain", (Update.hasError()) ? "FAIL" : "OK");
       response->addHeader("Connection", "close");
       request->send(response);
+      prefs->commit();
+      delay(200);
+      ESP.restart();
+    } });
+
+  // media image upload, written to the flash partition and mapped on restart
+  // the request handler only runs if the upload never got its final piece
+  server->on("/media", HTTP_POST, [this](AsyncWebServerRequest *request)
+             { abortMediaUpload(); }, [this](AsyncWebServerRequest *request, String filename, size_t index, uint8_t *data, size_t len, bool final)
+             {
+    if (index == 0) {
+      Serial.printf("Media upload start: %s\n", filename.c_str());
+      if (_mediaUploadCallback) {
+        _mediaUploadCallback();
+      }
+      _library->beginWrite();
+      request->onDisconnect([this]()
+                            { abortMediaUpload(); });
+    }
+    _library->write(index, data, len);
+    if (final) {
+      bool ok = _library->endWrite(index + len);
+      AsyncWebServerResponse *response = request->beginResponse(200, "text/plain", ok ? "OK" : "FAIL");
+      response->addHeader("Connection", "close");
+      request->send(response);
+      prefs->commit();
       delay(200);
       ESP.restart();
     } });
 }
 
+// The old image is erased as an upload is written, so one that stops part
+// way leaves nothing to play. Restart to fall back to streaming.
+void WifiManager::abortMediaUpload()
+{
+  if (_library->abortWrite())
+  {
+    prefs->commit();
+    ESP.restart();
+  }
+}
+
+void WifiManager::onMediaUpload(std::function<void()> callback)
+{
+  _mediaUploadCallback = callback;
+}
+
 void WifiManager::setupServer()
 {
   server->begin();
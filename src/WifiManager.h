@@ -9,8 +9,12 @@
 #include <Update.h>
 #include "Prefs.h"
 #include "Battery.h"
+#include "FlashLibrary.h"
 #include "AsyncJson.h"
 #include "OSD.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include <functional>
 
 // Embedded files
 extern const uint8_t index_html_start[] asm("_binary_src_www_index_html_start");
@@ -63,13 +67,17 @@ private:
 class WifiManager
 {
 public:
-  WifiManager(AsyncWebServer *server, Prefs *prefs, Battery *battery);
+  WifiManager(AsyncWebServer *server, Prefs *prefs, Battery *battery,
+              FlashLibrary *library);
   void begin();
   bool isConnected();
   bool isAPMode();
   void handleClient();
   IPAddress getIpAddress();
   String getApSsid();
+  // Called when a media upload starts, before the image in flash is erased,
+  // so whatever plays from it can be stopped
+  void onMediaUpload(std::function<void()> callback);
 
 private:
   static const char *PARAM_INPUT_1;
@@ -78,6 +86,8 @@ private:
   String _apSsid;
   Prefs *prefs;
   Battery *_battery;
+  FlashLibrary *_library;
+  std::function<void()> _mediaUploadCallback;
 
   AsyncWebServer *server;
   IPAddress localIP;
@@ -93,4 +103,5 @@ private:
   void setupCommonRoutes();
   void setupAccessPoint();
   void setupWifiPostHandler();
+  void abortMediaUpload();
 };
\ No newline at end of file
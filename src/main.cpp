@@ -1,11 +1,16 @@
 #include "Battery.h"
 #include "Button.h"
 #include "Display.h"
+#include "FlashLibrary.h"
+#include "ImagePlayer/FlashImageSource.h"
 #include "ImagePlayer/ImagePlayer.h"
 #include "ImagePlayer/SDCardImageSource.h"
+#include "Metrics.h"
 #include "Prefs.h"
 #include "SDCard.h"
+#include "Trace.h"
 #include "VideoPlayer/AVIParser.h"
+#include "VideoPlayer/FlashVideoSource.h"
 #include "VideoPlayer/SDCardVideoSource.h"
 #include "VideoPlayer/StreamVideoSource.h"
 #include "VideoPlayer/VideoPlayer.h"
@@ -27,6 +32,11 @@ ImageSource *imageSource = NULL;
 MediaPlayer *videoPlayer = NULL;
 MediaPlayer *imagePlayer = NULL;
 MediaPlayer *currentPlayer = NULL;
+// streaming from the web page while the media in flash plays, it takes over
+// the screen while a stream is running
+StreamVideoSource *streamSource = NULL;
+MediaPlayer *streamPlayer = NULL;
+MediaPlayer *resumePlayer = NULL;
 
 Prefs prefs;
 Display display(&prefs);
@@ -34,8 +44,21 @@ Button button(SYS_OUT, SYS_EN);
 AsyncWebServer server(80);
 Battery battery(BATTERY_VOLTAGE_PIN, 3.3, 200000.0, 100000.0);
 unsigned long shutdown_time = 0;
-WifiManager wifiManager(&server, &prefs, &battery);
+FlashLibrary flashLibrary;
+WifiManager wifiManager(&server, &prefs, &battery, &flashLibrary);
 bool wifiManagerActive = false;
+// playing the media in flash, which the button controls even with WiFi up
+bool flashPlayback = false;
+// the web server only runs without an SD card, so while the card plays the
+// metrics /metrics would serve are written to it instead
+const unsigned long METRICS_DUMP_MS = 10000;
+unsigned long lastMetricsDump = 0;
+#ifdef TRACE
+// the web server only runs without an SD card, so when there is one the
+// trace is written to it once this long after boot
+const unsigned long TRACE_DUMP_MS = 30000;
+bool traceDumped = false;
+#endif
 
 enum class PlaybackMode
 {
@@ -59,11 +82,39 @@ void setShutdownTime(int minutes)
   }
 }
 
+// Hand the screen to the stream while one is running and back to the media
+// in flash once it stops, true while the stream has it
+bool updateStreamTakeover()
+{
+  bool streaming = streamSource->getStreamState() == StreamState::STREAMING;
+  if (streaming && currentPlayer != streamPlayer)
+  {
+    resumePlayer = currentPlayer;
+    if (resumePlayer != nullptr)
+    {
+      resumePlayer->stop();
+    }
+    currentPlayer = streamPlayer;
+    currentPlayer->play();
+  }
+  else if (!streaming && currentPlayer == streamPlayer)
+  {
+    streamPlayer->stop();
+    currentPlayer = resumePlayer;
+    if (currentPlayer != nullptr)
+    {
+      currentPlayer->play();
+    }
+  }
+  return currentPlayer == streamPlayer;
+}
+
 void setup()
 {
   display.fillScreen(TFT_BLACK);
   Serial.begin(115200);
   delay(500); // Wait for serial to initialize
+  Trace::begin();
 
   battery.begin();
   prefs.begin();
@@ -73,6 +124,9 @@ void setup()
   prefs.onTimerMinutesChanged([](int minutes)
                               { setShutdownTime(minutes); });
   setShutdownTime(prefs.getTimerMinutes());
+  // don't lose a setting changed just before the power goes
+  button.onPowerOff([]()
+                    { prefs.commit(); });
   display.setBrightness(prefs.getBrightness());
   display.drawOSD("Tinytron", CENTER, STANDARD);
   display.drawOSD(TOSTRING(APP_VERSION) " " TOSTRING(APP_BUILD_NUMBER),
@@ -82,6 +136,7 @@ void setup()
   Serial.printf("Free heap: %d\n", ESP.getFreeHeap());
   Serial.printf("Total PSRAM: %d\n", ESP.getPsramSize());
   Serial.printf("Free PSRAM: %d\n", ESP.getFreePsram());
+  flashLibrary.begin();
 
   Serial.println("Looking for SD Card");
   SDCard *card =
@@ -96,6 +151,21 @@ void setup()
     Serial.println("Failed to mount SD Card. Initializing WifiManager.");
     wifiManager.begin();
     wifiManagerActive = true;
+    // frames from flash point straight into the image an upload erases, so
+    // stop drawing them first
+    wifiManager.onMediaUpload([]()
+                              {
+      if (flashPlayback)
+      {
+        if (videoPlayer != nullptr)
+        {
+          videoPlayer->stop();
+        }
+        if (imagePlayer != nullptr)
+        {
+          imagePlayer->stop();
+        }
+      } });
     Serial.printf("Wifi Connected: %s\n",
                   wifiManager.getIpAddress().toString().c_str());
     display.fillScreen(TFT_BLACK);
@@ -109,9 +179,37 @@ void setup()
     display.drawOSD(wifiManager.getIpAddress().toString().c_str(), CENTER,
                     STANDARD);
     display.flushSprite();
+
+    // the media in flash plays until a stream is started, it can be
+    // replaced from the web page
+    VideoSource *videoCandidate = new FlashVideoSource(&flashLibrary);
+    if (videoCandidate->fetchVideoData())
+    {
+      videoSource = videoCandidate;
+    }
+    else
+    {
+      delete videoCandidate;
+    }
+
+    ImageSource *imageCandidate = new FlashImageSource(&flashLibrary);
+    if (imageCandidate->fetchImageData())
+    {
+      imageSource = imageCandidate;
+    }
+    else
+    {
+      delete imageCandidate;
+    }
+
+    flashPlayback = videoSource != nullptr || imageSource != nullptr;
     if (!wifiManager.isAPMode())
     {
-      videoSource = new StreamVideoSource(&server);
+      streamSource = new StreamVideoSource(&server);
+      if (!flashPlayback)
+      {
+        videoSource = streamSource;
+      }
     }
   }
   else
@@ -145,7 +243,7 @@ void setup()
   if (videoSource != nullptr)
   {
     videoPlayer = new VideoPlayer(videoSource, display, prefs, battery);
-    if (wifiManagerActive && !wifiManager.isAPMode())
+    if (wifiManagerActive && !flashPlayback && !wifiManager.isAPMode())
     {
       videoPlayer->setWaitForFirstFrame(true);
     }
@@ -172,6 +270,15 @@ void setup()
     delay(500);
   }
 
+  if (flashPlayback && streamSource != nullptr)
+  {
+    streamPlayer = new VideoPlayer(streamSource, display, prefs, battery);
+    streamPlayer->setWaitForFirstFrame(true);
+    streamPlayer->start();
+    streamSource->fetchVideoData();
+    streamPlayer->set(0);
+  }
+
   if (videoSource != nullptr && imageSource != nullptr)
   {
     playbackMode = PlaybackMode::VIDEO_THEN_IMAGES;
@@ -226,46 +333,58 @@ void loop()
     lastBatteryUpdate = now;
   }
 
+  if (!wifiManagerActive && now - lastMetricsDump > METRICS_DUMP_MS)
+  {
+    Metrics::dump("/sdcard/metrics.json");
+    lastMetricsDump = now;
+  }
+
+#ifdef TRACE
+  if (!traceDumped && !wifiManagerActive && now > TRACE_DUMP_MS)
+  {
+    traceDumped = true;
+    bool ok = Trace::dump("/sdcard/trace.json");
+    Serial.println(ok ? "Trace written to trace.json" : "Failed to write trace");
+  }
+#endif
+
   button.update();
+  prefs.update();
   if (wifiManagerActive)
   {
     wifiManager.handleClient();
   }
 
-  if (!wifiManagerActive)
+  if (streamPlayer != nullptr && updateStreamTakeover())
+  {
+    // the stream has the screen, as it would without media in flash
+    return;
+  }
+
+  if (!wifiManagerActive || flashPlayback)
   {
     if (playbackMode == PlaybackMode::VIDEO_THEN_IMAGES)
     {
       if (currentPlayer == videoPlayer)
       {
-        SDCardVideoSource *sdVideoSource = (SDCardVideoSource *)videoSource;
-        if (sdVideoSource != nullptr && sdVideoSource->consumeWrapped())
+        if (videoSource->consumeWrapped())
         {
           videoPlayer->stop();
           currentPlayer = imagePlayer;
-          SDCardImageSource *sdImageSource = (SDCardImageSource *)imageSource;
-          if (sdImageSource != nullptr)
-          {
-            sdImageSource->consumeWrapped(); // Prevent bounce-back
-            imagePlayer->set(0);
-          }
+          imageSource->consumeWrapped(); // Prevent bounce-back
+          imagePlayer->set(0);
           delay(50);
           currentPlayer->play();
         }
       }
       else // currentPlayer == imagePlayer
       {
-        SDCardImageSource *sdImageSource = (SDCardImageSource *)imageSource;
-        if (sdImageSource != nullptr && sdImageSource->consumeWrapped())
+        if (imageSource->consumeWrapped())
         {
           imagePlayer->stop();
           currentPlayer = videoPlayer;
-          SDCardVideoSource *sdVideoSource = (SDCardVideoSource *)videoSource;
-          if (sdVideoSource != nullptr)
-          {
-            sdVideoSource->consumeWrapped(); // Prevent bounce-back
-            videoPlayer->set(0);
-          }
+          videoSource->consumeWrapped(); // Prevent bounce-back
+          videoPlayer->set(0);
           delay(50);
           currentPlayer->play();
         }
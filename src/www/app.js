@@ -25,6 +25,10 @@ const updateForm = document.getElementById('updateForm');
 const updateButton = document.getElementById('updateButton');
 const firmwareFile = document.getElementById('firmwareFile');
 const updateProgress = document.getElementById('updateProgress');
+const mediaForm = document.getElementById('mediaForm');
+const mediaButton = document.getElementById('mediaButton');
+const mediaFile = document.getElementById('mediaFile');
+const mediaProgress = document.getElementById('mediaProgress');
 const firmwareVersion = document.getElementById('firmwareVersion');
 const firmwareBuild = document.getElementById('firmwareBuild');
 const videoSourceSelect = document.getElementById('videoSource');
@@ -163,6 +167,51 @@ updateForm.addEventListener('submit', (event) => {
   xhr.send(formData);
 });
 
+// Media image upload, played from flash when there's no SD card
+mediaForm.addEventListener('submit', (event) => {
+  event.preventDefault();
+  const file = mediaFile.files[0];
+  if (!file) {
+    alert('Please select a media image.');
+    return;
+  }
+  mediaFile.disabled = true;
+  mediaButton.disabled = true;
+  mediaProgress.style.display = 'block';
+  mediaProgress.value = 0;
+
+  const xhr = new XMLHttpRequest();
+  xhr.open('POST', '/media', true);
+
+  xhr.upload.onprogress = (event) => {
+    if (event.lengthComputable) {
+      mediaProgress.value = (event.loaded / event.total) * 100;
+    }
+  };
+
+  xhr.onload = () => {
+    if (xhr.status === 200 && xhr.responseText === 'OK') {
+      alert('Upload successful! The device will now reboot.');
+    } else {
+      alert('Upload failed! Is this a file built by pack_media.py?');
+    }
+    mediaFile.disabled = false;
+    mediaProgress.style.display = 'none';
+    mediaButton.disabled = false;
+  };
+
+  xhr.onerror = () => {
+    alert('An error occurred during the upload.');
+    mediaFile.disabled = false;
+    mediaProgress.style.display = 'none';
+    mediaButton.disabled = false;
+  };
+
+  const formData = new FormData();
+  formData.append('media', file);
+  xhr.send(formData);
+});
+
 
 // Function to fetch and display battery status
 function fetchBatteryStatus() {